@@ -0,0 +1,49 @@
+#include "ephemeris_cache.h"
+
+#include <functional>
+
+namespace {
+
+constexpr uint64_t kFnvOffset = 0xcbf29ce484222325ULL;
+constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+}  // namespace
+
+bool EphemerisCache::Key::operator==(const Key& other) const {
+  return tle == other.tle && tolerance == other.tolerance &&
+         ticks == other.ticks &&
+         (lines == other.lines ||
+          (lines && other.lines && *lines == *other.lines));
+}
+
+size_t EphemerisCache::KeyHash::operator()(const Key& key) const {
+  size_t hash = std::hash<uint64_t>()(key.tle);
+  hash = HashCombine(hash, std::hash<double>()(key.tolerance));
+  return HashCombine(hash, std::hash<int64_t>()(key.ticks));
+}
+
+EphemerisCache::EphemerisCache(size_t budget, size_t shards)
+    : entries_(budget / Entries::kEntryBytes, shards) {}
+
+uint64_t EphemerisCache::Fingerprint(const std::string& first,
+                                     const std::string& second) {
+  uint64_t hash = kFnvOffset;
+  for (const std::string* line : {&first, &second}) {
+    for (unsigned char c : *line) {
+      hash = (hash ^ c) * kFnvPrime;
+    }
+    // Keeps "ab" + "c" apart from "a" + "bc".
+    hash = (hash ^ '\n') * kFnvPrime;
+  }
+  return hash;
+}
+
+EphemerisCache::Key EphemerisCache::MakeKey(const std::string& first,
+                                            const std::string& second) {
+  Key key;
+  key.tle = Fingerprint(first, second);
+  key.lines = std::make_shared<const std::string>(first + '\n' + second);
+  key.tolerance = 0;
+  key.ticks = 0;
+  return key;
+}
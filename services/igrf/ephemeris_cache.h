@@ -0,0 +1,77 @@
+/**
+ * @file ephemeris_cache.h
+ * @brief Bounded LRU cache of propagated TLE samples for igrf_server
+ *
+ * Entries are the geodetic positions SGP answered for a TLE at a tick, so
+ * computeTLE windows that overlap earlier ones only ask SGP for the samples
+ * they add. TLEs are told apart by their element lines rather than by
+ * computational id, which a client may construct anew for the same TLE.
+ * A fingerprint of the lines picks the bucket, and the lines themselves,
+ * shared by every entry of the TLE, settle a match, so TLEs crafted to
+ * share a fingerprint never answer for each other. Like ResultCache's, the
+ * entries live in a ShardedLru; its size is given as a memory budget.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "sharded_lru.h"
+
+class EphemerisCache {
+ public:
+  struct Key {
+    uint64_t tle;  // Fingerprint of `lines`
+    // Both element lines, newline separated.
+    std::shared_ptr<const std::string> lines;
+    double tolerance;  // km, the interpolation the samples were made with
+    int64_t ticks;
+
+    bool operator==(const Key& other) const;
+  };
+
+  // As SGP::CoordGeodetic.
+  struct Value {
+    double latitude;   // degrees
+    double longitude;  // degrees
+    double altitude;   // km
+  };
+
+  // Holds as many entries as `budget` bytes allow over `shards` shards.
+  EphemerisCache(size_t budget, size_t shards);
+
+  EphemerisCache(const EphemerisCache&) = delete;
+  EphemerisCache& operator=(const EphemerisCache&) = delete;
+
+  // FNV-1a over both lines, checksum digits included.
+  static uint64_t Fingerprint(const std::string& first,
+                              const std::string& second);
+  // A key for the TLE of these element lines; tolerance and ticks are left
+  // at zero for the caller to fill in.
+  static Key MakeKey(const std::string& first, const std::string& second);
+
+  // Copies the entry for `key` into `value` and marks it most recently used.
+  bool Lookup(const Key& key, Value* value) {
+    return entries_.Lookup(key, value);
+  }
+  void Insert(const Key& key, const Value& value) {
+    entries_.Insert(key, value);
+  }
+
+  size_t capacity() const { return entries_.capacity(); }
+  size_t size() const { return entries_.size(); }
+  uint64_t hits() const { return entries_.hits(); }
+  uint64_t misses() const { return entries_.misses(); }
+  uint64_t evictions() const { return entries_.evictions(); }
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  using Entries = ShardedLru<Key, Value, KeyHash>;
+
+  Entries entries_;
+};
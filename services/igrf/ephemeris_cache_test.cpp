@@ -0,0 +1,51 @@
+/**
+ * @file ephemeris_cache_test.cpp
+ * @brief In-process tests of EphemerisCache
+ */
+#include "ephemeris_cache.h"
+
+#include <string>
+
+#define CATCH_CONFIG_MAIN
+#include "../testing/catch.hpp"
+
+namespace {
+
+const char kFirst[] =
+    "1 25544U 98067A   20173.69712963  .00000371  00000-0  14697-4 0  9998";
+const char kSecond[] =
+    "2 25544  51.6445 326.1422 0002733  71.2042 114.5589 15.49451886232717";
+
+}  // namespace
+
+TEST_CASE("TLEs are matched on their element lines", "[ephemeris_cache]") {
+  EphemerisCache cache(1 << 20, 4);
+  EphemerisCache::Key key = EphemerisCache::MakeKey(kFirst, kSecond);
+  key.tolerance = 1e-3;
+  key.ticks = 637285248000000000;
+  cache.Insert(key, {51.0, -12.0, 420.0});
+
+  // Constructed anew for the same TLE, as a second computational id is.
+  EphemerisCache::Key same = EphemerisCache::MakeKey(kFirst, kSecond);
+  same.tolerance = key.tolerance;
+  same.ticks = key.ticks;
+  EphemerisCache::Value value = {};
+  REQUIRE(cache.Lookup(same, &value));
+  REQUIRE(value.latitude == 51.0);
+  REQUIRE(value.altitude == 420.0);
+
+  // Another TLE that shares the fingerprint, as a crafted one could.
+  std::string other(kSecond);
+  other[20] = '7';
+  EphemerisCache::Key colliding = EphemerisCache::MakeKey(kFirst, other);
+  colliding.tle = key.tle;
+  colliding.tolerance = key.tolerance;
+  colliding.ticks = key.ticks;
+  REQUIRE_FALSE(cache.Lookup(colliding, &value));
+  cache.Insert(colliding, {-3.0, 100.0, 35786.0});
+  REQUIRE(cache.Lookup(colliding, &value));
+  REQUIRE(value.latitude == -3.0);
+  REQUIRE(cache.Lookup(same, &value));
+  REQUIRE(value.latitude == 51.0);
+  REQUIRE(cache.size() == 2);
+}
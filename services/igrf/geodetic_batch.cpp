@@ -0,0 +1,192 @@
+// Vectorized Eci::ToGeodetic. The sidereal time is that of
+// DateTime::ToGreenwichSiderealTime, anchored at each UT midnight; the
+// geodetic latitude and height follow Vermeille (2011), "An analytical
+// method to transform geocentric into geodetic coordinates", J. Geodesy 85.
+#include "geodetic_batch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "sgp4/include/CoordGeodetic.h"
+#include "sgp4/include/DateTime.h"
+#include "sgp4/include/Eci.h"
+#include "sgp4/include/Globals.h"
+#include "sgp4/include/Util.h"
+#include "sgp4/include/Vector.h"
+#include "lane_math.h"
+
+namespace {
+
+constexpr int kMaxWidth = 8;
+
+// Vermeille's solution holds outside a small region around the centre of
+// the earth, far below any orbit.
+const double kA = kXKMPER;
+const double kE2 = kF * (2.0 - kF);
+
+// DateTime::ToGreenwichSiderealTime adds this many radians per tick of the
+// time of day to the value at midnight.
+const double kSiderealRate =
+    1.00273790935 * 86400.0 / 240.0 * kPI / 180.0 / TicksPerDay;
+
+using KernelFn = void (*)(const double* x, const double* y, const double* z,
+                          const double* gmst, double* latitude,
+                          double* longitude, double* altitude);
+
+struct Kernel {
+  KernelFn run;
+  size_t width;
+};
+
+// ToGreenwichSiderealTime at the midnight starting UT day `day`, counted in
+// whole days of ticks.
+double SiderealTimeAtMidnight(int64_t day) {
+  const double jd0 = static_cast<double>(day) + 1721425.5;
+  const double t = (jd0 - 2451545.0) / 36525.0;
+  const double gt =
+      24110.54841 + t * (8640184.812866 + t * (0.093104 - t * 6.2E-6));
+  return Util::WrapTwoPI(Util::DegreesToRadians(gt / 240.0));
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+using lane::Atan;
+using lane::Atan2;
+using lane::Cbrt;
+using lane::Floor;
+using lane::Sqrt;
+
+template <typename V, typename M, int W>
+__attribute__((always_inline)) inline void ConvertLanes(
+    const double* px, const double* py, const double* pz, const double* pg,
+    double* latitude, double* longitude, double* altitude) {
+  V x, y, z, gmst;
+  for (int i = 0; i < W; ++i) {
+    x[i] = px[i];
+    y[i] = py[i];
+    z[i] = pz[i];
+    gmst[i] = pg[i];
+  }
+  V theta, turns;
+  Atan2<V, M>(y, x, &theta);
+  const V lon = theta - gmst + kPI;
+  Floor(lon / kTWOPI, &turns);
+
+  const double e4 = kE2 * kE2;
+  const V w2 = x * x + y * y;
+  const V p = w2 / (kA * kA);
+  const V q = (1.0 - kE2) / (kA * kA) * z * z;
+  const V r = (p + q - e4) / 6.0;
+  const V s = e4 * p * q / (4.0 * r * r * r);
+  V root_s, t;
+  Sqrt<V, W>(s * (2.0 + s), &root_s);
+  Cbrt<V, M>(1.0 + s + root_s, &t);
+  const V u = r * (1.0 + t + 1.0 / t);
+  V v, k, w, d_z;
+  Sqrt<V, W>(u * u + e4 * q, &v);
+  const V wv = kE2 * (u + v - q) / (2.0 * v);
+  Sqrt<V, W>(u + v + wv * wv, &k);
+  k = k - wv;
+  Sqrt<V, W>(w2, &w);
+  const V d = k * w / (k + kE2);
+  Sqrt<V, W>(d * d + z * z, &d_z);
+  V half_lat;
+  Atan<V, M>(z / (d + d_z), &half_lat);
+  const V h = (k + kE2 - 1.0) / k * d_z;
+  for (int i = 0; i < W; ++i) {
+    latitude[i] = 2.0 * half_lat[i];
+    longitude[i] = lon[i] - kTWOPI * turns[i] - kPI;
+    altitude[i] = h[i];
+  }
+}
+
+typedef double V4 __attribute__((vector_size(32)));
+typedef long long M4 __attribute__((vector_size(32)));
+typedef double V8 __attribute__((vector_size(64)));
+typedef long long M8 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2,fma"))) void Avx2Kernel(
+    const double* x, const double* y, const double* z, const double* gmst,
+    double* latitude, double* longitude, double* altitude) {
+  ConvertLanes<V4, M4, 4>(x, y, z, gmst, latitude, longitude, altitude);
+}
+
+__attribute__((target("avx512f"))) void Avx512Kernel(
+    const double* x, const double* y, const double* z, const double* gmst,
+    double* latitude, double* longitude, double* altitude) {
+  ConvertLanes<V8, M8, 8>(x, y, z, gmst, latitude, longitude, altitude);
+}
+
+Kernel SelectKernel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return {Avx512Kernel, 8};
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {Avx2Kernel, 4};
+  }
+  return {nullptr, 1};
+}
+
+#else
+
+Kernel SelectKernel() {
+  return {nullptr, 1};
+}
+
+#endif
+
+}  // namespace
+
+void GeodeticSeries::Resize(size_t count) {
+  latitude.resize(count);
+  longitude.resize(count);
+  altitude.resize(count);
+}
+
+void EciToGeodetic(const int64_t* ticks, const double* x, const double* y,
+                   const double* z, size_t count, GeodeticSeries* geodetic) {
+  static const Kernel kernel = SelectKernel();
+  geodetic->Resize(count);
+  if (kernel.run == nullptr) {
+    for (size_t i = 0; i < count; ++i) {
+      const CoordGeodetic coord =
+          Eci(DateTime(ticks[i]), Vector(x[i], y[i], z[i])).ToGeodetic();
+      geodetic->latitude[i] = coord.latitude;
+      geodetic->longitude[i] = coord.longitude;
+      geodetic->altitude[i] = coord.altitude;
+    }
+    return;
+  }
+  std::vector<double> gmst(count);
+  int64_t day = 0;
+  double midnight = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const int64_t today = ticks[i] / TicksPerDay;
+    if (i == 0 || today != day) {
+      day = today;
+      midnight = SiderealTimeAtMidnight(day);
+    }
+    gmst[i] = midnight + (ticks[i] - day * TicksPerDay) * kSiderealRate;
+  }
+  size_t i = 0;
+  for (; i + kernel.width <= count; i += kernel.width) {
+    kernel.run(x + i, y + i, z + i, gmst.data() + i,
+               geodetic->latitude.data() + i, geodetic->longitude.data() + i,
+               geodetic->altitude.data() + i);
+  }
+  if (i == count) return;
+  // Pad the tail with copies of its last sample to fill a whole vector.
+  double tail[4][kMaxWidth], tail_out[3][kMaxWidth];
+  const size_t rest = count - i;
+  for (size_t j = 0; j < kernel.width; ++j) {
+    const size_t k = i + std::min(j, rest - 1);
+    tail[0][j] = x[k];
+    tail[1][j] = y[k];
+    tail[2][j] = z[k];
+    tail[3][j] = gmst[k];
+  }
+  kernel.run(tail[0], tail[1], tail[2], tail[3], tail_out[0], tail_out[1],
+             tail_out[2]);
+  std::copy(tail_out[0], tail_out[0] + rest, geodetic->latitude.data() + i);
+  std::copy(tail_out[1], tail_out[1] + rest, geodetic->longitude.data() + i);
+  std::copy(tail_out[2], tail_out[2] + rest, geodetic->altitude.data() + i);
+}
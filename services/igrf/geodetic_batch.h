@@ -0,0 +1,34 @@
+/**
+ * @file geodetic_batch.h
+ * @brief Eci::ToGeodetic for a whole series of ECI positions
+ *
+ * Eci::ToGeodetic evaluates the sidereal time polynomial of
+ * DateTime::ToGreenwichSiderealTime for every position and then iterates on
+ * the latitude. Within one UT day that polynomial is a linear function of
+ * the time of day, so here it is evaluated once per day and the sidereal
+ * time of every sample follows from its ticks since midnight. The latitude
+ * and height come from Vermeille's closed-form solution, a vector of
+ * samples at a time, on the ellipsoid of the SGP4 library (kXKMPER, kF).
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct GeodeticSeries {
+  std::vector<double> latitude;   // radians
+  std::vector<double> longitude;  // radians, in [-pi, pi)
+  std::vector<double> altitude;   // km above the ellipsoid
+
+  void Resize(size_t count);
+  size_t size() const { return latitude.size(); }
+};
+
+// Converts the ECI positions (x[i], y[i], z[i]) in km, taken at the
+// DateTime ticks[i], and resizes `geodetic` to hold them. Any order works;
+// a series sorted by time evaluates the sidereal time polynomial once per
+// UT day it spans. Agrees with Eci::ToGeodetic to within its 1e-10 rad
+// iteration tolerance.
+void EciToGeodetic(const int64_t* ticks, const double* x, const double* y,
+                   const double* z, size_t count, GeodeticSeries* geodetic);
@@ -0,0 +1,51 @@
+/**
+ * @file geodetic_batch_test.cpp
+ * @brief In-process tests of EciToGeodetic against Eci::ToGeodetic
+ */
+#include "geodetic_batch.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "sgp4/include/CoordGeodetic.h"
+#include "sgp4/include/DateTime.h"
+#include "sgp4/include/Eci.h"
+#include "sgp4/include/SGP4.h"
+#include "sgp4/include/Tle.h"
+
+#define CATCH_CONFIG_MAIN
+#include "../testing/catch.hpp"
+
+TEST_CASE("EciToGeodetic agrees with Eci::ToGeodetic", "[geodetic_batch]") {
+  const SGP4 iss(Tle("ISS",
+      "1 25544U 98067A   20173.69712963  "
+      ".00000371  00000-0  14697-4 0  9998",
+      "2 25544  51.6445 326.1422 0002733  "
+      "71.2042 114.5589 15.49451886232717"));
+  // A day of positions, a number that is not a multiple of any vector
+  // width, dated a day after they were propagated so that they span a UT
+  // midnight.
+  std::vector<int64_t> ticks;
+  std::vector<double> x, y, z;
+  for (int i = 0; i < 1443; ++i) {
+    const double minutes = -60.0 + i * 1.01;
+    const Eci eci = iss.FindPosition(minutes);
+    ticks.push_back(eci.GetDateTime().Ticks() + 864000000000LL);
+    x.push_back(eci.Position().x);
+    y.push_back(eci.Position().y);
+    z.push_back(eci.Position().z);
+  }
+  GeodeticSeries geodetic;
+  EciToGeodetic(ticks.data(), x.data(), y.data(), z.data(), ticks.size(),
+                &geodetic);
+  REQUIRE(geodetic.size() == ticks.size());
+  for (size_t i = 0; i < ticks.size(); ++i) {
+    const CoordGeodetic coord =
+        Eci(DateTime(ticks[i]), Vector(x[i], y[i], z[i])).ToGeodetic();
+    REQUIRE(std::abs(geodetic.latitude[i] - coord.latitude) < 1e-9);
+    REQUIRE(std::abs(std::remainder(geodetic.longitude[i] - coord.longitude,
+                                    2 * M_PI)) < 1e-8);
+    REQUIRE(std::abs(geodetic.altitude[i] - coord.altitude) < 1e-6);
+  }
+}
@@ -10,12 +10,15 @@
  */
 
 
+#include <algorithm>
 #include <chrono>  // linter failure
+#include <cmath>
 #include <iostream>
 #include <memory>
 #include <random>
 #include <string>
 #include <thread>  // same as chrono
+#include <vector>
 #include <future>
 
 #include "grpc/grpc.h"
@@ -29,6 +32,8 @@
 #include "sgp4/include/DateTime.h"
 #include "sgp4/include/Eci.h"
 #include "sgp4/include/CoordGeodetic.h"
+#include "sgp4/include/SGP4.h"
+#include "sgp4/include/Tle.h"
 
 #define CATCH_CONFIG_MAIN
 #include "../testing/catch.hpp"
@@ -101,6 +106,256 @@ SCENARIO("IGRF Service's client can be instantiated and used") {
       }
     }
 
+    WHEN("Computation is invoked for several points sharing a date") {
+      Point request;
+      auto now = DateTime::Now().Ticks();
+      for (int lat = -60; lat <= 60; lat += 30) {
+        auto c = request.add_coord();
+        c->set_lon(0);
+        c->set_lat(lat);
+        c->set_alt(0);
+        c->set_encoded_time(now);
+      }
+      request.set_add_noise_to_igrf(false);
+      PointResult response;
+      Status status = stub->computeForPoint(&context, request, &response);
+      THEN("Every point gets its own result, in request order") {
+        REQUIRE(status.ok());
+        REQUIRE(response.result().size() == request.coord().size());
+        REQUIRE(response.result(0).z() < 0);
+        REQUIRE(response.result(4).z() > 0);
+        REQUIRE(response.truncation_error(0) == 0);
+      }
+      AND_WHEN("The expansion is truncated at degree 6") {
+        grpc::ClientContext truncated_context;
+        request.set_max_degree(6);
+        PointResult truncated;
+        status = stub->computeForPoint(&truncated_context, request,
+                                       &truncated);
+        THEN("The change stays within the reported bound") {
+          REQUIRE(status.ok());
+          for (int i = 0; i < truncated.result().size(); ++i) {
+            const double dx = truncated.result(i).x() - response.result(i).x();
+            const double dy = truncated.result(i).y() - response.result(i).y();
+            const double dz = truncated.result(i).z() - response.result(i).z();
+            REQUIRE(truncated.truncation_error(i) > 0);
+            REQUIRE(std::sqrt(dx * dx + dy * dy + dz * dz) <=
+                    truncated.truncation_error(i));
+          }
+        }
+      }
+    }
+
+    WHEN("Points are computed in columnar form") {
+      Point request;
+      auto now = DateTime::Now().Ticks();
+      for (int lat : {0, 45, 90}) {
+        auto c = request.add_coord();
+        c->set_lon(10);
+        c->set_lat(lat);
+        c->set_alt(0);
+        c->set_encoded_time(now);
+      }
+      PointResult messages, columnar;
+      Status status = stub->computeForPoint(&context, request, &messages);
+      grpc::ClientContext columnar_context;
+      request.set_columnar(true);
+      Status columnar_status =
+          stub->computeForPoint(&columnar_context, request, &columnar);
+      THEN("The columns hold the same values as the messages") {
+        REQUIRE(status.ok());
+        REQUIRE(columnar_status.ok());
+        const IGRF::PointColumns& columns = columnar.columns();
+        REQUIRE(columnar.result().empty());
+        REQUIRE(columns.z().size() == 3);
+        REQUIRE(columnar.error_code().size() == 3);
+        for (int i = 0; i < 3; ++i) {
+          REQUIRE(columns.x(i) == messages.result(i).x());
+          REQUIRE(columns.z(i) == messages.result(i).z());
+          REQUIRE(columns.z_dot(i) == messages.variance(i).z_dot());
+          REQUIRE(columns.declination(i) ==
+                  messages.result(i).declination());
+        }
+        REQUIRE(columns.has_x().size() == 1);
+        REQUIRE(columns.has_x()[0] == 0x3);
+        REQUIRE(columns.has_declination()[0] == 0x3);
+      }
+    }
+
+    WHEN("A grid is computed") {
+      IGRF::GridRequest request;
+      auto now = DateTime::Now().Ticks();
+      request.set_encoded_time(now);
+      request.mutable_latitude()->set_start(-30);
+      request.mutable_latitude()->set_step(30);
+      request.mutable_latitude()->set_count(3);
+      request.mutable_longitude()->set_start(-90);
+      request.mutable_longitude()->set_step(60);
+      request.mutable_longitude()->set_count(4);
+      request.mutable_altitude()->set_start(0.5);
+      request.add_components(IGRF::GRID_Z);
+      request.add_components(IGRF::GRID_DECLINATION);
+      IGRF::GridResult grid;
+      Status status = stub->computeGrid(&context, request, &grid);
+
+      Point point;
+      auto c = point.add_coord();
+      c->set_lat(0);
+      c->set_lon(30);
+      c->set_alt(0.5);
+      c->set_encoded_time(now);
+      grpc::ClientContext point_context;
+      PointResult single;
+      Status point_status =
+          stub->computeForPoint(&point_context, point, &single);
+      THEN("Every cell matches the same point computed on its own") {
+        REQUIRE(status.ok());
+        REQUIRE(point_status.ok());
+        REQUIRE(grid.error_code() == 0);
+        REQUIRE(grid.values().size() == 3 * 4 * 2);
+        const int cell = (1 * 4 + 2) * 2;
+        REQUIRE(std::abs(grid.values(cell) - single.result(0).z()) < 1e-2);
+        REQUIRE(std::abs(grid.values(cell + 1) -
+                         single.result(0).declination()) < 1e-4);
+      }
+      AND_WHEN("The grid is too large") {
+        grpc::ClientContext large_context;
+        request.mutable_latitude()->set_count(100000);
+        request.mutable_longitude()->set_count(100000);
+        status = stub->computeGrid(&large_context, request, &grid);
+        THEN("It is refused") {
+          REQUIRE(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+        }
+      }
+    }
+
+    WHEN("A site is registered and evaluated at several dates") {
+      IGRF::SiteRequest site;
+      site.mutable_coord()->set_lat(55.75);
+      site.mutable_coord()->set_lon(37.62);
+      site.mutable_coord()->set_alt(0.2);
+      IGRF::SiteResponse handle;
+      Status status = stub->registerSite(&context, site, &handle);
+      REQUIRE(status.ok());
+
+      Point by_site, by_coord;
+      by_site.set_site_id(handle.site_id());
+      auto now = DateTime::Now();
+      for (int day = 0; day < 3; ++day) {
+        const uint64_t ticks = now.AddDays(day * 30).Ticks();
+        by_site.add_encoded_time(ticks);
+        *by_coord.add_coord() = site.coord();
+        by_coord.mutable_coord(day)->set_encoded_time(ticks);
+      }
+      grpc::ClientContext site_context, coord_context, release_context;
+      PointResult site_result, coord_result;
+      Status site_status =
+          stub->computeForPoint(&site_context, by_site, &site_result);
+      Status coord_status =
+          stub->computeForPoint(&coord_context, by_coord, &coord_result);
+      IGRF::SiteReleaseRequest release;
+      release.set_site_id(handle.site_id());
+      IGRF::EndResponse released;
+      Status release_status =
+          stub->releaseSite(&release_context, release, &released);
+      THEN("The results match the plain computation until it is released") {
+        REQUIRE(site_status.ok());
+        REQUIRE(coord_status.ok());
+        REQUIRE(site_result.result().size() == 3);
+        for (int i = 0; i < 3; ++i) {
+          REQUIRE(std::abs(site_result.result(i).x() -
+                           coord_result.result(i).x()) < 1e-6);
+          REQUIRE(std::abs(site_result.result(i).z() -
+                           coord_result.result(i).z()) < 1e-6);
+        }
+        REQUIRE(release_status.ok());
+        grpc::ClientContext stale_context;
+        PointResult stale;
+        REQUIRE(stub->computeForPoint(&stale_context, by_site, &stale)
+                    .error_code() == grpc::StatusCode::NOT_FOUND);
+      }
+    }
+
+    WHEN("The model is reloaded") {
+      IGRF::ModelReloadRequest request;
+      request.set_path("./IGRF13.COF");
+      IGRF::ModelReloadResponse response;
+      Status status = stub->reloadModel(&context, request, &response);
+      grpc::ClientContext missing_context;
+      IGRF::ModelReloadRequest missing;
+      missing.set_path("./missing.COF");
+      Status missing_status =
+          stub->reloadModel(&missing_context, missing, &response);
+      THEN("Only a loadable model is accepted") {
+        REQUIRE(status.ok());
+        REQUIRE(response.min_date() == 1900);
+        REQUIRE(response.max_date() == 2025);
+        REQUIRE(missing_status.error_code() ==
+                grpc::StatusCode::INVALID_ARGUMENT);
+      }
+    }
+
+    WHEN("A second model is loaded under its own id") {
+      IGRF::ModelReloadRequest request;
+      request.set_path("./IGRF13.COF");
+      request.set_model_id("local");
+      IGRF::ModelReloadResponse loaded;
+      Status status = stub->reloadModel(&context, request, &loaded);
+      REQUIRE(status.ok());
+
+      Point point;
+      auto c = point.add_coord();
+      c->set_lat(45);
+      c->set_lon(45);
+      c->set_alt(0);
+      c->set_encoded_time(DateTime::Now().Ticks());
+      grpc::ClientContext default_context, local_context, unknown_context;
+      PointResult by_default, by_local, by_unknown;
+      Status default_status =
+          stub->computeForPoint(&default_context, point, &by_default);
+      point.set_model_id("local");
+      Status local_status =
+          stub->computeForPoint(&local_context, point, &by_local);
+      point.set_model_id("missing");
+      Status unknown_status =
+          stub->computeForPoint(&unknown_context, point, &by_unknown);
+      THEN("Requests can pick either model, and only a loaded one") {
+        REQUIRE(default_status.ok());
+        REQUIRE(local_status.ok());
+        REQUIRE(by_local.result(0).z() == by_default.result(0).z());
+        REQUIRE(unknown_status.error_code() == grpc::StatusCode::NOT_FOUND);
+      }
+    }
+
+    WHEN("The same point is computed twice") {
+      Point point;
+      auto c = point.add_coord();
+      c->set_lat(-33.9);
+      c->set_lon(18.4);
+      c->set_alt(0.1);
+      c->set_encoded_time(DateTime::Now().Ticks());
+      IGRF::CacheStatsRequest stats_request;
+      IGRF::CacheStatsResponse before, after;
+      grpc::ClientContext first_context, second_context, after_context;
+      Status status = stub->cacheStats(&context, stats_request, &before);
+      PointResult first, second;
+      Status first_status =
+          stub->computeForPoint(&first_context, point, &first);
+      Status second_status =
+          stub->computeForPoint(&second_context, point, &second);
+      Status after_status =
+          stub->cacheStats(&after_context, stats_request, &after);
+      THEN("The second one is answered from the cache") {
+        REQUIRE(status.ok());
+        REQUIRE(first_status.ok());
+        REQUIRE(second_status.ok());
+        REQUIRE(after_status.ok());
+        REQUIRE(after.hits() == before.hits() + 1);
+        REQUIRE(after.entries() <= after.capacity());
+        REQUIRE(second.result(0).x() == first.result(0).x());
+        REQUIRE(second.result(0).z() == first.result(0).z());
+      }
+    }
 
     WHEN("Construction is invoked") {
       SGPConstructRequest request;
@@ -142,6 +397,352 @@ SCENARIO("IGRF Service's client can be instantiated and used") {
       }
     }
 
+    WHEN("Computation is invoked for TLE in many chunks") {
+      TLEComputeRequest request;
+      request.set_add_noise_to_igrf(false);
+      request.set_add_noise_to_sgp(false);
+      request.set_computational_id(id);
+      auto range = request.mutable_time_range();
+      range->set_start(DateTime::Now().Ticks());
+      range->set_step(TimeSpan(0, 1, 0).Ticks());
+      range->set_count(100);
+      TLEComputeResponse whole, chunked;
+      Status status = stub->computeTLE(&context, request, &whole);
+      grpc::ClientContext chunked_context;
+      request.set_chunk_size(3);
+      Status chunked_status =
+          stub->computeTLE(&chunked_context, request, &chunked);
+      THEN("The results are the same, in the order of the samples") {
+        REQUIRE(status.ok());
+        REQUIRE(chunked_status.ok());
+        REQUIRE(chunked.results().result().size() == 100);
+        for (int i = 0; i < 100; ++i) {
+          REQUIRE(chunked.results().result(i).z() ==
+                  whole.results().result(i).z());
+        }
+      }
+    }
+
+    WHEN("Streaming computation is invoked for TLE") {
+      TLEComputeRequest request;
+      request.set_add_noise_to_igrf(false);
+      request.set_add_noise_to_sgp(false);
+      request.set_computational_id(id);
+      request.set_chunk_size(2);
+      auto now = DateTime::Now();
+      for (int i = 0; i < 5; ++i) {
+        request.add_encoded_time(now.AddSeconds(i).Ticks());
+      }
+      auto reader = stub->computeTLEStream(&context, request);
+      TLEComputeResponse response;
+      std::vector<int> chunks;
+      while (reader->Read(&response)) {
+        chunks.push_back(response.results().result().size());
+      }
+      Status status = reader->Finish();
+      THEN("Results arrive in chunks of at most chunk_size samples") {
+        REQUIRE(status.ok());
+        REQUIRE(chunks == std::vector<int>{2, 2, 1});
+      }
+    }
+
+    WHEN("Computation is invoked for a time range") {
+      TLEComputeRequest request;
+      request.set_add_noise_to_igrf(false);
+      request.set_add_noise_to_sgp(false);
+      request.set_computational_id(id);
+      auto range = request.mutable_time_range();
+      range->set_start(DateTime::Now().Ticks());
+      range->set_step(TimeSpan(0, 1, 0).Ticks());
+      range->set_count(3);
+      TLEComputeResponse response;
+      Status status = stub->computeTLE(&context, request, &response);
+      THEN("A result is received for every sample in the range") {
+        REQUIRE(status.ok());
+        REQUIRE(response.results().result().size() == 3);
+      }
+      AND_WHEN("encoded_time is filled as well") {
+        grpc::ClientContext retry;
+        request.add_encoded_time(range->start());
+        status = stub->computeTLE(&retry, request, &response);
+        THEN("The request is rejected") {
+          REQUIRE(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+        }
+      }
+      AND_WHEN("The range does not step forward") {
+        grpc::ClientContext still_context;
+        range->set_step(0);
+        status = stub->computeTLE(&still_context, request, &response);
+        THEN("It is refused") {
+          REQUIRE(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+        }
+      }
+      AND_WHEN("The range runs past the last tick") {
+        grpc::ClientContext overflow_context;
+        range->set_step(uint64_t(1) << 62);
+        status = stub->computeTLE(&overflow_context, request, &response);
+        grpc::ClientContext start_context;
+        range->set_start(uint64_t(1) << 63);
+        range->set_step(1);
+        range->set_count(1);
+        Status start_status =
+            stub->computeTLE(&start_context, request, &response);
+        THEN("It is refused") {
+          REQUIRE(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+          REQUIRE(start_status.error_code() ==
+                  grpc::StatusCode::INVALID_ARGUMENT);
+        }
+      }
+      AND_WHEN("The range is too long for one response") {
+        grpc::ClientContext large_context;
+        range->set_count((uint64_t(1) << 32) + 16);
+        request.set_chunk_size(8);
+        request.set_columnar(true);
+        status = stub->computeTLE(&large_context, request, &response);
+        THEN("It is refused") {
+          REQUIRE(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+        }
+      }
+    }
+
+    WHEN("A constellation is propagated to one instant") {
+      IGRF::ConstellationRequest request;
+      for (int i = 0; i < 1000; ++i) {
+        SGPConstructRequest* tle = request.add_tles();
+        tle->set_title("ISS");
+        tle->set_first(
+            "1 25544U 98067A   20173.69712963  "
+            ".00000371  00000-0  14697-4 0  9998");
+        tle->set_second(
+            "2 25544  51.6445 326.1422 0002733  "
+            "71.2042 114.5589 15.49451886232717");
+      }
+      request.mutable_tles(7)->set_second("garbage");
+      const DateTime date(2020, 6, 23, 0, 0, 0);
+      request.set_encoded_time(date.Ticks());
+      IGRF::ConstellationResult response;
+      Status status =
+          stub->propagateConstellation(&context, request, &response);
+      const Tle tle("ISS", request.tles(0).first(), request.tles(0).second());
+      const Eci expected = SGP4(tle).FindPosition(date);
+      THEN("Every TLE but the broken one has SGP4's state") {
+        REQUIRE(status.ok());
+        REQUIRE(response.x_size() == 1000);
+        REQUIRE(response.vz_size() == 1000);
+        REQUIRE(response.failures_size() == 1);
+        REQUIRE(response.failures(0).index() == 7);
+        REQUIRE(response.x(7) == 0);
+        for (int i : {0, 6, 8, 999}) {
+          REQUIRE(std::fabs(response.x(i) - expected.Position().x) < 1e-6);
+          REQUIRE(std::fabs(response.y(i) - expected.Position().y) < 1e-6);
+          REQUIRE(std::fabs(response.z(i) - expected.Position().z) < 1e-6);
+          REQUIRE(std::fabs(response.vx(i) - expected.Velocity().x) < 1e-9);
+        }
+      }
+    }
+
+    WHEN("A server propagates TLEs in process") {
+      FILE* local = popen("./igrf_server 9092 --test --sgp=local", "w");
+      REQUIRE(local != nullptr);
+      sleep(1);
+      auto local_stub = IGRFService::NewStub(grpc::CreateChannel(
+          "localhost:9092", grpc::InsecureChannelCredentials()));
+      SGPConstructRequest construct;
+      construct.set_title("ISS");
+      construct.set_first(
+          "1 25544U 98067A   20173.69712963  "
+          ".00000371  00000-0  14697-4 0  9998");
+      construct.set_second(
+          "2 25544  51.6445 326.1422 0002733  "
+          "71.2042 114.5589 15.49451886232717");
+      SGPConstructResponse constructed;
+      Status construct_status =
+          local_stub->construct(&context, construct, &constructed);
+
+      TLEComputeRequest request;
+      request.set_computational_id(constructed.computational_id());
+      auto range = request.mutable_time_range();
+      range->set_start(DateTime(2020, 6, 22, 12, 0, 0).Ticks());
+      range->set_step(TimeSpan(0, 10, 0).Ticks());
+      range->set_count(20);
+      TLEComputeResponse response;
+      grpc::ClientContext compute_context, end_context, again_context;
+      Status compute_status =
+          local_stub->computeTLE(&compute_context, request, &response);
+      grpc::ClientContext stream_context;
+      request.set_chunk_size(8);
+      auto reader = local_stub->computeTLEStream(&stream_context, request);
+      TLEComputeResponse chunk;
+      std::vector<int> chunks;
+      while (reader->Read(&chunk)) {
+        chunks.push_back(chunk.results().result().size());
+      }
+      Status stream_status = reader->Finish();
+      // Half of this window was propagated for the first one.
+      TLEComputeRequest overlapping;
+      overlapping.set_computational_id(constructed.computational_id());
+      *overlapping.mutable_time_range() = *range;
+      overlapping.mutable_time_range()->set_start(range->start() +
+                                                  10 * range->step());
+      TLEComputeResponse overlapping_response;
+      IGRF::CacheStatsRequest stats_request;
+      IGRF::CacheStatsResponse stats_before, stats_after;
+      grpc::ClientContext overlapping_context, before_context, after_context;
+      local_stub->cacheStats(&before_context, stats_request, &stats_before);
+      Status overlapping_status = local_stub->computeTLE(
+          &overlapping_context, overlapping, &overlapping_response);
+      local_stub->cacheStats(&after_context, stats_request, &stats_after);
+      // Ten minutes at 10 Hz, propagated sample by sample and interpolated
+      // to within a metre.
+      TLEComputeRequest dense;
+      dense.set_computational_id(constructed.computational_id());
+      auto dense_range = dense.mutable_time_range();
+      dense_range->set_start(range->start());
+      dense_range->set_step(TimeSpan(0, 0, 0, 0, 100000).Ticks());
+      dense_range->set_count(6000);
+      TLEComputeResponse direct_response, dense_response, invalid_response;
+      grpc::ClientContext direct_context, dense_context, invalid_context;
+      Status direct_status = local_stub->computeTLE(&direct_context, dense,
+                                                    &direct_response);
+      dense.set_interpolation_tolerance(1e-3);
+      Status dense_status =
+          local_stub->computeTLE(&dense_context, dense, &dense_response);
+      dense.set_interpolation_tolerance(-1);
+      Status invalid_status =
+          local_stub->computeTLE(&invalid_context, dense, &invalid_response);
+      // An endless window asked for in one chunk comes in capped ones.
+      TLEComputeRequest endless;
+      endless.set_computational_id(constructed.computational_id());
+      *endless.mutable_time_range() = *range;
+      endless.mutable_time_range()->set_step(
+          TimeSpan(0, 0, 0, 0, 1000).Ticks());
+      endless.mutable_time_range()->set_count(uint64_t(1) << 40);
+      endless.set_chunk_size(4000000000u);
+      grpc::ClientContext endless_context;
+      auto endless_reader =
+          local_stub->computeTLEStream(&endless_context, endless);
+      TLEComputeResponse endless_chunk;
+      const bool endless_read = endless_reader->Read(&endless_chunk);
+      // The stream, stalled on a client that reads no further, must not
+      // hold up a reload.
+      IGRF::ModelReloadRequest reload;
+      reload.set_path("./IGRF13.COF");
+      IGRF::ModelReloadResponse reloaded;
+      grpc::ClientContext reload_context;
+      reload_context.set_deadline(std::chrono::system_clock::now() +
+                                  std::chrono::seconds(10));
+      Status reload_status =
+          local_stub->reloadModel(&reload_context, reload, &reloaded);
+      endless_context.TryCancel();
+      while (endless_reader->Read(&chunk)) {}
+      Status endless_status = endless_reader->Finish();
+      EndRequest end;
+      end.set_computational_id(constructed.computational_id());
+      EndResponse ended;
+      Status end_status = local_stub->endWork(&end_context, end, &ended);
+      Status again_status = local_stub->endWork(&again_context, end, &ended);
+      fprintf(local, "STOP");
+      pclose(local);
+      THEN("The samples are evaluated without an SGP service") {
+        REQUIRE(construct_status.ok());
+        REQUIRE(compute_status.ok());
+        REQUIRE(response.results().result().size() == 20);
+        for (const auto& result : response.results().result()) {
+          REQUIRE(result.total_intensity() > 15000);
+          REQUIRE(result.total_intensity() < 70000);
+        }
+        REQUIRE(stream_status.ok());
+        REQUIRE(chunks == std::vector<int>{8, 8, 4});
+        REQUIRE(overlapping_status.ok());
+        REQUIRE(stats_before.ephemeris_capacity() > 0);
+        REQUIRE(stats_after.ephemeris_hits() - stats_before.ephemeris_hits() ==
+                10);
+        REQUIRE(stats_after.ephemeris_misses() -
+                    stats_before.ephemeris_misses() == 10);
+        for (int i = 0; i < 20; ++i) {
+          const auto& result = overlapping_response.results().result(i);
+          REQUIRE(result.sdate() > 0);
+          if (i < 10) {
+            REQUIRE(result.total_intensity() ==
+                    response.results().result(i + 10).total_intensity());
+          }
+        }
+        REQUIRE(direct_status.ok());
+        REQUIRE(dense_status.ok());
+        REQUIRE(dense_response.results().result().size() == 6000);
+        for (int i = 0; i < 6000; ++i) {
+          REQUIRE(std::fabs(
+              dense_response.results().result(i).total_intensity() -
+              direct_response.results().result(i).total_intensity()) < 0.1);
+        }
+        REQUIRE(invalid_status.error_code() ==
+                grpc::StatusCode::INVALID_ARGUMENT);
+        REQUIRE(endless_read);
+        REQUIRE(reload_status.ok());
+        REQUIRE(endless_chunk.results().result().size() == 16384);
+        REQUIRE(endless_status.error_code() == grpc::StatusCode::CANCELLED);
+        REQUIRE(end_status.ok());
+        REQUIRE(again_status.error_code() == grpc::StatusCode::NOT_FOUND);
+      }
+    }
+
+    WHEN("A server without worker threads propagates TLEs in process") {
+      FILE* local = popen("./igrf_server 9093 --test --sgp=local --threads=0",
+                          "w");
+      REQUIRE(local != nullptr);
+      sleep(1);
+      auto local_stub = IGRFService::NewStub(grpc::CreateChannel(
+          "localhost:9093", grpc::InsecureChannelCredentials()));
+      SGPConstructRequest construct;
+      construct.set_title("ISS");
+      construct.set_first(
+          "1 25544U 98067A   20173.69712963  "
+          ".00000371  00000-0  14697-4 0  9998");
+      construct.set_second(
+          "2 25544  51.6445 326.1422 0002733  "
+          "71.2042 114.5589 15.49451886232717");
+      SGPConstructResponse constructed;
+      Status construct_status =
+          local_stub->construct(&context, construct, &constructed);
+      TLEComputeRequest request;
+      request.set_computational_id(constructed.computational_id());
+      auto range = request.mutable_time_range();
+      range->set_start(DateTime(2020, 6, 22, 12, 0, 0).Ticks());
+      range->set_step(TimeSpan(0, 1, 0).Ticks());
+      range->set_count(64);
+      request.set_chunk_size(16);
+      grpc::ClientContext compute_context;
+      compute_context.set_deadline(std::chrono::system_clock::now() +
+                                   std::chrono::seconds(10));
+      TLEComputeResponse response;
+      Status compute_status =
+          local_stub->computeTLE(&compute_context, request, &response);
+      // A chunk a sample: the handler thread goes through them one after
+      // another, not one stack frame deeper each. The response outgrows
+      // gRPC's default 4 MB.
+      grpc::ChannelArguments unlimited;
+      unlimited.SetMaxReceiveMessageSize(-1);
+      auto many_stub = IGRFService::NewStub(grpc::CreateCustomChannel(
+          "localhost:9093", grpc::InsecureChannelCredentials(), unlimited));
+      range->set_count(500000);
+      request.set_chunk_size(1);
+      grpc::ClientContext many_context;
+      many_context.set_deadline(std::chrono::system_clock::now() +
+                                std::chrono::seconds(60));
+      TLEComputeResponse many;
+      Status many_status =
+          many_stub->computeTLE(&many_context, request, &many);
+      fprintf(local, "STOP");
+      pclose(local);
+      THEN("Its work runs on the handler threads instead") {
+        REQUIRE(construct_status.ok());
+        REQUIRE(compute_status.ok());
+        REQUIRE(response.results().result().size() == 64);
+        REQUIRE(many_status.ok());
+        REQUIRE(many.results().result().size() == 500000);
+      }
+    }
+
     WHEN("Connection is, finally, closed") {
       EndRequest request;
       request.set_computational_id(id);
@@ -0,0 +1,27 @@
+/**
+ * @file igrf_cof_compiler.cpp
+ * @brief Compiles a geomag70 .COF file into the binary image igrf_server maps
+ *
+ * Usage: igrf_cof_compiler IGRF13.COF IGRF13.img
+ */
+#include <iostream>
+
+#include "igrf_model.h"
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <model.COF> <model.img>"
+              << std::endl;
+    return 2;
+  }
+  IGRFModel model;
+  if (!model.Load(argv[1])) {
+    std::cerr << "Failed to load " << argv[1] << std::endl;
+    return 1;
+  }
+  if (!model.SaveImage(argv[2])) {
+    std::cerr << "Failed to write " << argv[2] << std::endl;
+    return 1;
+  }
+  return 0;
+}
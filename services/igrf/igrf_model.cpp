@@ -0,0 +1,936 @@
+#include "igrf_model.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr double kEarthRadius = 6371.2;
+constexpr double kDegToRad = M_PI / 180.0;
+constexpr double kRadToDeg = 180.0 / M_PI;
+constexpr double kA2 = 40680631.59;  // WGS84 semi-major axis squared
+constexpr double kB2 = 40408299.98;  // WGS84 semi-minor axis squared
+constexpr double kFeetPerKm = 3280.0839895;
+constexpr int kMaxTerms =
+    IGRFModel::kMaxDegree * (IGRFModel::kMaxDegree + 3) / 2;
+
+int CoefficientCount(int nmax) {
+  return nmax * (nmax + 2);
+}
+
+// Rounds a number of doubles up to whole cache lines.
+size_t PadToLine(size_t count) {
+  constexpr size_t line = IGRFModel::kCacheLine / sizeof(double);
+  return (count + line - 1) / line * line;
+}
+
+bool IsLeapYear(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+struct Angles {
+  double d;
+  double i;
+  double h;
+  double f;
+};
+
+// dihf from geomag70.
+Angles Resolve(const IGRFModel::Field& field) {
+  constexpr double sn = 0.0001;
+  Angles a;
+  const double h2 = field.x * field.x + field.y * field.y;
+  a.h = std::sqrt(h2);
+  a.f = std::sqrt(h2 + field.z * field.z);
+  if (a.f < sn) {
+    a.d = std::numeric_limits<double>::quiet_NaN();
+    a.i = std::numeric_limits<double>::quiet_NaN();
+  } else {
+    a.i = std::atan2(field.z, a.h);
+    if (a.h < sn) {
+      a.d = std::numeric_limits<double>::quiet_NaN();
+    } else {
+      const double hpx = a.h + field.x;
+      a.d = hpx < sn ? M_PI : 2.0 * std::atan2(field.y, hpx);
+    }
+  }
+  return a;
+}
+
+}  // namespace
+
+IGRFModel::~IGRFModel() {
+  Release();
+}
+
+void IGRFModel::AlignedFree::operator()(double* values) const {
+  ::operator delete[](values, std::align_val_t(kCacheLine));
+}
+
+void IGRFModel::Release() {
+  epochs_.clear();
+  storage_.reset();
+  if (mapping_ != nullptr) munmap(mapping_, mapping_size_);
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+}
+
+bool IGRFModel::Load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file.is_open()) return false;
+  // Coefficients go into one contiguous store, every epoch's main field and
+  // secular variation starting on a cache line of their own; the epochs are
+  // pointed at their slices once it has stopped growing.
+  std::vector<Epoch> epochs;
+  std::vector<double> storage;
+  std::vector<size_t> offsets;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string first;
+    if (!(fields >> first)) continue;
+    if (!std::isdigit(static_cast<unsigned char>(first[0]))) {
+      Epoch epoch;
+      int max3;
+      epoch.name = first;
+      if (!(fields >> epoch.epoch >> epoch.max1 >> epoch.max2 >> max3
+                   >> epoch.yrmin >> epoch.yrmax)) {
+        return false;
+      }
+      if (epoch.max1 > kMaxDegree || epoch.max2 > kMaxDegree) return false;
+      offsets.push_back(storage.size());
+      storage.resize(storage.size() + PadToLine(CoefficientCount(epoch.max1)) +
+                     PadToLine(CoefficientCount(epoch.max2)));
+      epochs.push_back(std::move(epoch));
+      continue;
+    }
+    if (epochs.empty()) return false;
+    int m;
+    double g, h, g_dot, h_dot;
+    const int n = std::atoi(first.c_str());
+    if (!(fields >> m >> g >> h >> g_dot >> h_dot) || n < 1 || m > n) {
+      return false;
+    }
+    const int g_index = n * n - 1 + (m == 0 ? 0 : 2 * m - 1);
+    const Epoch& epoch = epochs.back();
+    double* main = storage.data() + offsets.back();
+    double* sv = main + PadToLine(CoefficientCount(epoch.max1));
+    if (n <= epoch.max1) {
+      main[g_index] = g;
+      if (m != 0) main[g_index + 1] = h;
+    }
+    if (n <= epoch.max2) {
+      sv[g_index] = g_dot;
+      if (m != 0) sv[g_index + 1] = h_dot;
+    }
+  }
+  if (epochs.empty()) return false;
+  Release();
+  storage_.reset(static_cast<double*>(::operator new[](
+      storage.size() * sizeof(double), std::align_val_t(kCacheLine))));
+  std::copy(storage.begin(), storage.end(), storage_.get());
+  for (size_t i = 0; i < epochs.size(); ++i) {
+    epochs[i].main = storage_.get() + offsets[i];
+    epochs[i].sv = epochs[i].main + PadToLine(CoefficientCount(epochs[i].max1));
+  }
+  epochs_ = std::move(epochs);
+  return true;
+}
+
+namespace {
+
+// Binary image layout: an ImageHeader, epoch_count ImageEpoch records, and
+// value_count doubles starting at the next multiple of kImageAlignment.
+// Everything is in host byte order; byte_order rejects images written on a
+// host with the other one.
+constexpr char kImageMagic[8] = {'I', 'G', 'R', 'F', 'I', 'M', 'G', '\0'};
+constexpr uint32_t kImageVersion = 1;
+constexpr uint32_t kImageByteOrder = 0x01020304;
+constexpr size_t kImageAlignment = IGRFModel::kCacheLine;
+
+struct ImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t epoch_count;
+  uint64_t value_count;
+};
+
+struct ImageEpoch {
+  char name[16];
+  double epoch;
+  double yrmin;
+  double yrmax;
+  int32_t max1;
+  int32_t max2;
+  uint64_t main;  // offsets into the values, in doubles
+  uint64_t sv;
+};
+
+size_t ImageValuesOffset(uint64_t epoch_count) {
+  const size_t end = sizeof(ImageHeader) + epoch_count * sizeof(ImageEpoch);
+  return (end + kImageAlignment - 1) / kImageAlignment * kImageAlignment;
+}
+
+}  // namespace
+
+bool IGRFModel::SaveImage(const std::string& path) const {
+  if (epochs_.empty()) return false;
+  ImageHeader header = {};
+  std::memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+  header.version = kImageVersion;
+  header.byte_order = kImageByteOrder;
+  header.epoch_count = epochs_.size();
+  std::vector<ImageEpoch> records(epochs_.size());
+  std::vector<double> values;
+  for (size_t i = 0; i < epochs_.size(); ++i) {
+    const Epoch& epoch = epochs_[i];
+    ImageEpoch& record = records[i];
+    std::strncpy(record.name, epoch.name.c_str(), sizeof(record.name) - 1);
+    record.epoch = epoch.epoch;
+    record.yrmin = epoch.yrmin;
+    record.yrmax = epoch.yrmax;
+    record.max1 = epoch.max1;
+    record.max2 = epoch.max2;
+    record.main = values.size();
+    values.insert(values.end(), epoch.main,
+                  epoch.main + CoefficientCount(epoch.max1));
+    values.resize(PadToLine(values.size()));
+    record.sv = values.size();
+    values.insert(values.end(), epoch.sv,
+                  epoch.sv + CoefficientCount(epoch.max2));
+    values.resize(PadToLine(values.size()));
+  }
+  header.value_count = values.size();
+
+  // Written aside and renamed into place: a server may have the old image
+  // mapped, and truncating a mapped file under it would fault.
+  const std::string staging = path + ".tmp";
+  std::ofstream file(staging, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) return false;
+  const std::vector<char> padding(
+      ImageValuesOffset(records.size()) - sizeof(header) -
+      records.size() * sizeof(ImageEpoch));
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(records.data()),
+             records.size() * sizeof(ImageEpoch));
+  file.write(padding.data(), padding.size());
+  file.write(reinterpret_cast<const char*>(values.data()),
+             values.size() * sizeof(double));
+  file.close();
+  if (!file) {
+    std::remove(staging.c_str());
+    return false;
+  }
+  return std::rename(staging.c_str(), path.c_str()) == 0;
+}
+
+bool IGRFModel::LoadImage(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(ImageHeader)) {
+    close(fd);
+    return false;
+  }
+  const size_t size = info.st_size;
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+
+  const char* base = static_cast<const char*>(mapping);
+  const ImageHeader* header = reinterpret_cast<const ImageHeader*>(base);
+  bool valid =
+      std::memcmp(header->magic, kImageMagic, sizeof(kImageMagic)) == 0 &&
+      header->version == kImageVersion &&
+      header->byte_order == kImageByteOrder &&
+      header->epoch_count > 0 &&
+      header->epoch_count <= (size - sizeof(ImageHeader)) / sizeof(ImageEpoch);
+  valid = valid && header->value_count <=
+      (size - ImageValuesOffset(header->epoch_count)) / sizeof(double);
+  std::vector<Epoch> epochs;
+  if (valid) {
+    const ImageEpoch* records =
+        reinterpret_cast<const ImageEpoch*>(base + sizeof(ImageHeader));
+    const double* values = reinterpret_cast<const double*>(
+        base + ImageValuesOffset(header->epoch_count));
+    for (uint64_t i = 0; valid && i < header->epoch_count; ++i) {
+      const ImageEpoch& record = records[i];
+      valid = record.max1 >= 0 && record.max1 <= kMaxDegree &&
+              record.max2 >= 0 && record.max2 <= kMaxDegree &&
+              record.main <= header->value_count &&
+              header->value_count - record.main >=
+                  static_cast<uint64_t>(CoefficientCount(record.max1)) &&
+              record.sv <= header->value_count &&
+              header->value_count - record.sv >=
+                  static_cast<uint64_t>(CoefficientCount(record.max2));
+      Epoch epoch;
+      epoch.name.assign(record.name, strnlen(record.name, sizeof(record.name)));
+      epoch.epoch = record.epoch;
+      epoch.max1 = record.max1;
+      epoch.max2 = record.max2;
+      epoch.yrmin = record.yrmin;
+      epoch.yrmax = record.yrmax;
+      epoch.main = values + record.main;
+      epoch.sv = values + record.sv;
+      epochs.push_back(std::move(epoch));
+    }
+  }
+  if (!valid) {
+    munmap(mapping, size);
+    return false;
+  }
+  Release();
+  mapping_ = mapping;
+  mapping_size_ = size;
+  epochs_ = std::move(epochs);
+  return true;
+}
+
+double IGRFModel::MinDate() const {
+  return epochs_.empty() ? 0 : epochs_.front().yrmin;
+}
+
+double IGRFModel::MaxDate() const {
+  return epochs_.empty() ? 0 : epochs_.back().yrmax;
+}
+
+bool IGRFModel::Interpolate(double sdate, Coefficients* coefficients) const {
+  coefficients->sdate = sdate;
+  coefficients->nmax = 0;
+  if (std::isnan(sdate)) {
+    coefficients->error_code = kBadDate;
+    return false;
+  }
+  if (epochs_.empty() || !(sdate >= MinDate() && sdate <= MaxDate())) {
+    coefficients->error_code = kDateOutOfRange;
+    return false;
+  }
+  size_t i = 0;
+  while (i + 1 < epochs_.size() && !(sdate < epochs_[i].yrmax)) ++i;
+  const Epoch& epoch = epochs_[i];
+  if (epoch.max2 == 0) {
+    if (i + 1 == epochs_.size()) {
+      coefficients->error_code = kDateOutOfRange;
+      return false;
+    }
+    const Epoch& next = epochs_[i + 1];
+    InterpolateEpochs(sdate, epoch, next, &coefficients->gh);
+    InterpolateEpochs(sdate + 1, epoch, next, &coefficients->gh_next);
+    coefficients->nmax = std::max(epoch.max1, next.max1);
+  } else {
+    ExtrapolateEpoch(sdate, epoch, &coefficients->gh);
+    ExtrapolateEpoch(sdate + 1, epoch, &coefficients->gh_next);
+    coefficients->nmax = std::max(epoch.max1, epoch.max2);
+  }
+  coefficients->degree_bound.assign(coefficients->nmax + 1, 0.0);
+  for (int n = 1; n <= coefficients->nmax; ++n) {
+    double power = 0;
+    for (int l = n * n - 1; l < n * (n + 2); ++l) {
+      power += coefficients->gh[l] * coefficients->gh[l];
+    }
+    coefficients->degree_bound[n] = std::sqrt((n + 1) * (2 * n + 1) * power);
+  }
+  coefficients->error_code = kOk;
+  return true;
+}
+
+double IGRFModel::TruncationBound(const Coefficients& coefficients,
+                                  int degree, double ratio) {
+  double bound = 0;
+  double rr = std::pow(ratio, degree + 2);
+  for (int n = degree + 1; n <= coefficients.nmax; ++n) {
+    rr *= ratio;
+    bound += rr * coefficients.degree_bound[n];
+  }
+  return bound;
+}
+
+// interpsh: linear interpolation between two epochs, a missing degree in
+// either of them counts as zero.
+void IGRFModel::InterpolateEpochs(double date, const Epoch& first,
+                                  const Epoch& second,
+                                  std::vector<double>* gh) {
+  const double factor = (date - first.epoch) / (second.epoch - first.epoch);
+  const size_t first_count = CoefficientCount(first.max1);
+  const size_t second_count = CoefficientCount(second.max1);
+  const size_t count = std::max(first_count, second_count);
+  gh->resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const double a = i < first_count ? first.main[i] : 0.0;
+    const double b = i < second_count ? second.main[i] : 0.0;
+    (*gh)[i] = a + factor * (b - a);
+  }
+}
+
+// extrapsh: main field plus the secular variation times the years elapsed.
+void IGRFModel::ExtrapolateEpoch(double date, const Epoch& epoch,
+                                 std::vector<double>* gh) {
+  const double factor = date - epoch.epoch;
+  const size_t main_count = CoefficientCount(epoch.max1);
+  const size_t sv_count = CoefficientCount(epoch.max2);
+  const size_t count = std::max(main_count, sv_count);
+  gh->resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const double g = i < main_count ? epoch.main[i] : 0.0;
+    const double g_dot = i < sv_count ? epoch.sv[i] : 0.0;
+    (*gh)[i] = g + factor * g_dot;
+  }
+}
+
+// geomag70's julday with the leap year test corrected.
+double IGRFModel::DecimalYear(int year, int month, int day) {
+  static const int first_day[13] =
+      {0, 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  const int leap = IsLeapYear(year) ? 1 : 0;
+  const int day_of_year = first_day[month] + day + (month > 2 ? leap : 0);
+  return year + day_of_year / (365.0 + leap);
+}
+
+bool IGRFModel::ParseDate(const char* date, double* sdate) {
+  if (date == nullptr) return false;
+  int year = 0, month = 0, day = 0;
+  char tail = 0;
+  if (std::sscanf(date, "%d,%d,%d%c", &year, &month, &day, &tail) == 3) {
+    if (month < 1 || month > 12 || day < 1 || day > 31) return false;
+    *sdate = DecimalYear(year, month, day);
+    return true;
+  }
+  char* end = nullptr;
+  *sdate = std::strtod(date, &end);
+  return end != date && *end == '\0';
+}
+
+IGRFModel::Locus IGRFModel::Locate(double latitude, double longitude,
+                                   double altitude, bool geodetic) {
+  Locus at;
+  double clipped = latitude;
+  if (90.0 - latitude < 0.001) {
+    clipped = 89.999;  // 300 ft. from North pole
+  } else if (90.0 + latitude < 0.001) {
+    clipped = -89.999;  // 300 ft. from South pole
+  }
+  at.at_pole = 90.0 - std::fabs(latitude) <= 0.001;
+  at.slat = std::sin(latitude * kDegToRad);
+  at.clat = std::cos(clipped * kDegToRad);
+  at.sin_lon = std::sin(longitude * kDegToRad);
+  at.cos_lon = std::cos(longitude * kDegToRad);
+  at.cd = 1.0;
+  at.sd = 0.0;
+  double r = kEarthRadius + altitude;
+  if (geodetic) {
+    const double aa = kA2 * at.clat * at.clat;
+    const double bb = kB2 * at.slat * at.slat;
+    const double cc = aa + bb;
+    const double dd = std::sqrt(cc);
+    r = std::sqrt(altitude * (altitude + 2.0 * dd) + (kA2 * aa + kB2 * bb) / cc);
+    at.cd = (altitude + dd) / r;
+    at.sd = (kA2 - kB2) / dd * at.slat * at.clat / r;
+    const double slat = at.slat;
+    at.slat = at.slat * at.cd - at.clat * at.sd;
+    at.clat = at.clat * at.cd + slat * at.sd;
+  }
+  at.ratio = kEarthRadius / r;
+  return at;
+}
+
+namespace {
+
+// The position-dependent part of shval3: Schmidt-normalized Legendre
+// functions p and their derivatives q for terms 1..npq, and sin/cos(m * lon)
+// for m = 0..nmax.
+void Recurse(const IGRFModel::Locus& at, int nmax, double* p, double* q,
+             double* sl, double* cl) {
+  const double slat = at.slat;
+  const double clat = at.clat;
+  const double sqrt3 = std::sqrt(3.0);
+  sl[0] = 0.0;
+  cl[0] = 1.0;
+  sl[1] = at.sin_lon;
+  cl[1] = at.cos_lon;
+  p[1] = 2.0 * slat;
+  p[2] = 2.0 * clat;
+  p[3] = 4.5 * slat * slat - 1.5;
+  p[4] = 3.0 * sqrt3 * clat * slat;
+  q[1] = -clat;
+  q[2] = slat;
+  q[3] = -3.0 * clat * slat;
+  q[4] = sqrt3 * (slat * slat - clat * clat);
+
+  const int npq = nmax * (nmax + 3) / 2;
+  int n = 0, m = 1;
+  double fn = 0;
+  for (int k = 1; k <= npq; ++k, ++m) {
+    if (n < m) {
+      m = 0;
+      ++n;
+      fn = n;
+    }
+    if (k < 5) continue;
+    const double fm = m;
+    if (m == n) {
+      const double aa = std::sqrt(1.0 - 0.5 / fm);
+      const int j = k - n - 1;
+      p[k] = (1.0 + 1.0 / fm) * aa * clat * p[j];
+      q[k] = aa * (clat * q[j] + slat / fm * p[j]);
+      sl[m] = sl[m - 1] * cl[1] + cl[m - 1] * sl[1];
+      cl[m] = cl[m - 1] * cl[1] - sl[m - 1] * sl[1];
+    } else {
+      const double aa = std::sqrt(fn * fn - fm * fm);
+      const double bb = std::sqrt((fn - 1.0) * (fn - 1.0) - fm * fm) / aa;
+      const double cc = (2.0 * fn - 1.0) / aa;
+      const int ii = k - n;
+      const int j = k - 2 * n + 1;
+      p[k] = (fn + 1.0) * (cc * slat / fn * p[ii] - bb / (fn - 1.0) * p[j]);
+      q[k] = cc * (slat * q[ii] - clat / fn * p[ii]) - bb * q[j];
+    }
+  }
+}
+
+}  // namespace
+
+void IGRFModel::Synthesize(const Locus& at, int nmax,
+                           const double* gh, const double* gh_next,
+                           Field* field, Field* field_next) {
+  double p[kMaxTerms + 1], q[kMaxTerms + 1];
+  double sl[kMaxDegree + 1], cl[kMaxDegree + 1];
+  Recurse(at, nmax, p, q, sl, cl);
+  const double slat = at.slat;
+  const double clat = at.clat;
+
+  Field a = {0, 0, 0}, b = {0, 0, 0};
+  const int npq = nmax * (nmax + 3) / 2;
+  int l = 0, n = 0, m = 1;
+  double rr = 0, fn = 0;
+  for (int k = 1; k <= npq; ++k) {
+    if (n < m) {
+      m = 0;
+      ++n;
+      rr = std::pow(at.ratio, n + 2);
+      fn = n;
+    }
+    const double fm = m;
+    if (m == 0) {
+      const double ga = rr * gh[l], gb = rr * gh_next[l];
+      a.x += ga * q[k];
+      a.z -= ga * p[k];
+      b.x += gb * q[k];
+      b.z -= gb * p[k];
+      l += 1;
+    } else {
+      const double ga = rr * gh[l], ha = rr * gh[l + 1];
+      const double gb = rr * gh_next[l], hb = rr * gh_next[l + 1];
+      const double ca = ga * cl[m] + ha * sl[m];
+      const double cb = gb * cl[m] + hb * sl[m];
+      a.x += ca * q[k];
+      a.z -= ca * p[k];
+      b.x += cb * q[k];
+      b.z -= cb * p[k];
+      const double dy = clat > 0 ? fm * p[k] / ((fn + 1.0) * clat)
+                                 : q[k] * slat;
+      a.y += (ga * sl[m] - ha * cl[m]) * dy;
+      b.y += (gb * sl[m] - hb * cl[m]) * dy;
+      l += 2;
+    }
+    ++m;
+  }
+  field->x = a.x * at.cd + a.z * at.sd;
+  field->y = a.y;
+  field->z = a.z * at.cd - a.x * at.sd;
+  field_next->x = b.x * at.cd + b.z * at.sd;
+  field_next->y = b.y;
+  field_next->z = b.z * at.cd - b.x * at.sd;
+}
+
+// The same terms as Synthesize, kept per coefficient instead of summed.
+IGRFModel::Site IGRFModel::PrepareSite(const Locus& at) {
+  double p[kMaxTerms + 1], q[kMaxTerms + 1];
+  double sl[kMaxDegree + 1], cl[kMaxDegree + 1];
+  Recurse(at, kMaxDegree, p, q, sl, cl);
+
+  Site site;
+  site.at = at;
+  const int count = CoefficientCount(kMaxDegree);
+  site.x.resize(count);
+  site.y.resize(count);
+  site.z.resize(count);
+  auto put = [&](int l, double x, double y, double z) {
+    site.x[l] = x * at.cd + z * at.sd;
+    site.y[l] = y;
+    site.z[l] = z * at.cd - x * at.sd;
+  };
+  int l = 0;
+  for (int n = 1, k = 1; n <= kMaxDegree; ++n) {
+    const double rr = std::pow(at.ratio, n + 2);
+    const double fn = n;
+    for (int m = 0; m <= n; ++m, ++k) {
+      const double fm = m;
+      if (m == 0) {
+        put(l, rr * q[k], 0.0, -rr * p[k]);
+        l += 1;
+        continue;
+      }
+      const double dy = at.clat > 0 ? fm * p[k] / ((fn + 1.0) * at.clat)
+                                    : q[k] * at.slat;
+      put(l, rr * cl[m] * q[k], rr * sl[m] * dy, -rr * cl[m] * p[k]);
+      put(l + 1, rr * sl[m] * q[k], -rr * cl[m] * dy, -rr * sl[m] * p[k]);
+      l += 2;
+    }
+  }
+  return site;
+}
+
+namespace {
+
+IGRFModel::Locus LocateRequest(const IGRFModel::Request& request) {
+  double altitude = request.altitude;
+  if (request.altitude_type == 'M') {
+    altitude /= 1000.0;
+  } else if (request.altitude_type == 'F') {
+    altitude /= kFeetPerKm;
+  }
+  return IGRFModel::Locate(request.latitude, request.longitude, altitude,
+                           request.coord_type != 'C');
+}
+
+// Fills the components of `result` from the synthesized `field`, whose
+// angles are `now`. The date is left alone.
+void FillResult(const IGRFModel::Locus& at, const IGRFModel::Field& field,
+                const Angles& now, igrf_computation_result* result) {
+  result->declination = now.d * kRadToDeg;
+  result->inclination = now.i * kRadToDeg;
+  result->horizontal_intensity = now.h;
+  result->total_intensity = now.f;
+  result->x = field.x;
+  result->y = field.y;
+  result->z = field.z;
+  // Declination is undefined close to the magnetic poles, and neither it nor
+  // the north component is defined at the geographic ones.
+  result->has_declination = now.h >= 100.0 && !at.at_pole;
+  result->has_x = !at.at_pole;
+}
+
+// Turns the synthesized field and its value a year later into the result
+// and secular variation geomag70 reports.
+void Complete(const IGRFModel::Locus& at, const IGRFModel::Field& field,
+              const IGRFModel::Field& field_next,
+              igrf_computation* computation) {
+  const Angles now = Resolve(field);
+  const Angles next = Resolve(field_next);
+
+  double ddot = (next.d - now.d) * kRadToDeg;
+  if (ddot > 180.0) ddot -= 360.0;
+  if (ddot <= -180.0) ddot += 360.0;
+
+  igrf_computation_result& result = computation->result;
+  igrf_computation_secular_variance& variance = computation->variance;
+  FillResult(at, field, now, &result);
+  variance.declination_dot = ddot * 60.0;
+  variance.inclination_dot = (next.i - now.i) * kRadToDeg * 60.0;
+  variance.horizontal_intensity_dot = next.h - now.h;
+  variance.total_intensity_dot = next.f - now.f;
+  variance.x_dot = field_next.x - field.x;
+  variance.y_dot = field_next.y - field.y;
+  variance.z_dot = field_next.z - field.z;
+  variance.has_declination = result.has_declination;
+  variance.has_x = result.has_x;
+}
+
+// Copies the date and error code of `coefficients` into `computation`;
+// false when the date left nothing to evaluate.
+bool Stamp(const IGRFModel::Coefficients& coefficients,
+           igrf_computation* computation) {
+  computation->error_code = coefficients.error_code;
+  computation->result.sdate = coefficients.sdate;
+  computation->variance.sdate = coefficients.sdate;
+  if (coefficients.error_code == IGRFModel::kOk) return true;
+  computation->result.has_x = computation->variance.has_x = false;
+  computation->result.has_declination = false;
+  computation->variance.has_declination = false;
+  return false;
+}
+
+// The coefficient sets of one batch, interpolated once per distinct date.
+class DateCache {
+ public:
+  explicit DateCache(const IGRFModel& model) : model_(model) {
+    bad_date_.error_code = IGRFModel::kBadDate;
+  }
+
+  const IGRFModel::Coefficients* Get(double sdate) {
+    if (std::isnan(sdate)) {
+      last_ = &bad_date_;
+    } else if (last_ == nullptr || !(last_->sdate == sdate)) {
+      auto it = by_date_.find(sdate);
+      if (it == by_date_.end()) {
+        it = by_date_.emplace(sdate, IGRFModel::Coefficients()).first;
+        model_.Interpolate(sdate, &it->second);
+      }
+      last_ = &it->second;
+    }
+    return last_;
+  }
+
+ private:
+  const IGRFModel& model_;
+  std::unordered_map<double, IGRFModel::Coefficients> by_date_;
+  IGRFModel::Coefficients bad_date_;
+  const IGRFModel::Coefficients* last_ = nullptr;
+};
+
+int DegreeOf(const IGRFModel::Coefficients& coefficients, int max_degree) {
+  return max_degree > 0 ? std::min(coefficients.nmax, max_degree)
+                        : coefficients.nmax;
+}
+
+// Points evaluated per SynthesizeBatch call; a multiple of every vector
+// width the kernels use.
+constexpr size_t kBlock = 64;
+
+// Longitudes of a row summed together by EvaluateRow, small enough for the
+// partial sums and the slices of the trig tables to stay in L1.
+constexpr size_t kRowTile = 256;
+
+}  // namespace
+
+void IGRFModel::Evaluate(const Coefficients& coefficients,
+                         const Request& request,
+                         igrf_computation* computation) {
+  if (!Stamp(coefficients, computation)) return;
+  const Locus at = LocateRequest(request);
+  Field field, field_next;
+  Synthesize(at, coefficients.nmax, coefficients.gh.data(),
+             coefficients.gh_next.data(), &field, &field_next);
+  Complete(at, field, field_next, computation);
+}
+
+void IGRFModel::EvaluateBlock(const Coefficients& coefficients, int degree,
+                              const Request* const* requests, size_t count,
+                              igrf_computation* const* computations,
+                              double* const* bounds) {
+  if (coefficients.error_code != kOk) {
+    for (size_t i = 0; i < count; ++i) {
+      Stamp(coefficients, computations[i]);
+      if (bounds != nullptr) *bounds[i] = 0;
+    }
+    return;
+  }
+  Locus at[kBlock] = {};
+  Field fields[kBlock], fields_next[kBlock];
+  for (size_t i = 0; i < count; ++i) at[i] = LocateRequest(*requests[i]);
+  SynthesizeBatch(at, count, degree, coefficients.gh.data(),
+                  coefficients.gh_next.data(), fields, fields_next);
+  for (size_t i = 0; i < count; ++i) {
+    Stamp(coefficients, computations[i]);
+    Complete(at[i], fields[i], fields_next[i], computations[i]);
+    if (bounds != nullptr) {
+      *bounds[i] = TruncationBound(coefficients, degree, at[i].ratio);
+    }
+  }
+}
+
+void IGRFModel::ComputeBatch(const Request* requests, size_t count,
+                             igrf_computation* computations, int max_degree,
+                             double* truncation_bounds) const {
+  DateCache dates(*this);
+  // Requests are gathered per coefficient set, and each full block goes
+  // through the vector kernel in one call.
+  std::unordered_map<const Coefficients*, std::vector<size_t>> pending;
+  auto flush = [&](const Coefficients* coefficients,
+                   std::vector<size_t>* indices) {
+    const Request* block_requests[kBlock];
+    igrf_computation* block_computations[kBlock];
+    double* block_bounds[kBlock];
+    for (size_t j = 0; j < indices->size(); ++j) {
+      block_requests[j] = &requests[(*indices)[j]];
+      block_computations[j] = &computations[(*indices)[j]];
+      if (truncation_bounds != nullptr) {
+        block_bounds[j] = &truncation_bounds[(*indices)[j]];
+      }
+    }
+    EvaluateBlock(*coefficients, DegreeOf(*coefficients, max_degree),
+                  block_requests, indices->size(),
+                  block_computations,
+                  truncation_bounds != nullptr ? block_bounds : nullptr);
+    indices->clear();
+  };
+  for (size_t i = 0; i < count; ++i) {
+    const Coefficients* coefficients = dates.Get(requests[i].sdate);
+    std::vector<size_t>& indices = pending[coefficients];
+    indices.push_back(i);
+    if (indices.size() == kBlock) flush(coefficients, &indices);
+  }
+  for (auto& entry : pending) {
+    if (!entry.second.empty()) flush(entry.first, &entry.second);
+  }
+}
+
+void IGRFModel::EvaluateSite(const Coefficients& coefficients,
+                             const Site& site, int max_degree,
+                             igrf_computation* computation,
+                             double* truncation_bound) {
+  if (truncation_bound != nullptr) *truncation_bound = 0;
+  if (!Stamp(coefficients, computation)) return;
+  const int degree = DegreeOf(coefficients, max_degree);
+  const double* gh = coefficients.gh.data();
+  const double* gh_next = coefficients.gh_next.data();
+  Field field = {0, 0, 0}, field_next = {0, 0, 0};
+  for (int l = 0, count = CoefficientCount(degree); l < count; ++l) {
+    field.x += gh[l] * site.x[l];
+    field.y += gh[l] * site.y[l];
+    field.z += gh[l] * site.z[l];
+    field_next.x += gh_next[l] * site.x[l];
+    field_next.y += gh_next[l] * site.y[l];
+    field_next.z += gh_next[l] * site.z[l];
+  }
+  Complete(site.at, field, field_next, computation);
+  if (truncation_bound != nullptr) {
+    *truncation_bound = TruncationBound(coefficients, degree, site.at.ratio);
+  }
+}
+
+void IGRFModel::ComputeSite(const Site& site, const double* sdates,
+                            size_t count, igrf_computation* computations,
+                            int max_degree, double* truncation_bounds) const {
+  DateCache dates(*this);
+  for (size_t i = 0; i < count; ++i) {
+    EvaluateSite(*dates.Get(sdates[i]), site, max_degree, &computations[i],
+                 truncation_bounds != nullptr ? &truncation_bounds[i]
+                                              : nullptr);
+  }
+}
+
+IGRFModel::Meridians IGRFModel::PrepareMeridians(const double* longitudes,
+                                                 size_t count) {
+  Meridians meridians;
+  meridians.count = count;
+  meridians.sin_m.resize((kMaxDegree + 1) * count);
+  meridians.cos_m.resize((kMaxDegree + 1) * count);
+  double* sin_m = meridians.sin_m.data();
+  double* cos_m = meridians.cos_m.data();
+  for (size_t j = 0; j < count; ++j) {
+    const double s = std::sin(longitudes[j] * kDegToRad);
+    const double c = std::cos(longitudes[j] * kDegToRad);
+    sin_m[j] = 0.0;
+    cos_m[j] = 1.0;
+    // The same angle-sum recursion as Recurse, so that a grid agrees with
+    // a point evaluated on its own.
+    for (int m = 1; m <= kMaxDegree; ++m) {
+      const double ps = sin_m[(m - 1) * count + j];
+      const double pc = cos_m[(m - 1) * count + j];
+      sin_m[m * count + j] = m == 1 ? s : ps * c + pc * s;
+      cos_m[m * count + j] = m == 1 ? c : pc * c - ps * s;
+    }
+  }
+  return meridians;
+}
+
+double IGRFModel::EvaluateRow(const Coefficients& coefficients,
+                              int max_degree, double latitude,
+                              double altitude, const Meridians& meridians,
+                              igrf_computation_result* results) {
+  const size_t count = meridians.count;
+  const Locus at = Locate(latitude, 0.0, altitude, true);
+  for (size_t j = 0; j < count; ++j) results[j].sdate = coefficients.sdate;
+  if (coefficients.error_code != kOk) {
+    for (size_t j = 0; j < count; ++j) {
+      results[j].has_x = results[j].has_declination = false;
+    }
+    return 0;
+  }
+  const int degree = DegreeOf(coefficients, max_degree);
+  double p[kMaxTerms + 1], q[kMaxTerms + 1];
+  double sl[kMaxDegree + 1], cl[kMaxDegree + 1];
+  Recurse(at, degree, p, q, sl, cl);
+
+  // Per order m, the row's field is x = xc[m] cos(m lon) + xs[m] sin(m lon)
+  // summed over m, and likewise for y and z.
+  double xc[kMaxDegree + 1] = {}, xs[kMaxDegree + 1] = {};
+  double yc[kMaxDegree + 1] = {}, ys[kMaxDegree + 1] = {};
+  double zc[kMaxDegree + 1] = {}, zs[kMaxDegree + 1] = {};
+  const double* gh = coefficients.gh.data();
+  int l = 0;
+  for (int n = 1, k = 1; n <= degree; ++n) {
+    const double rr = std::pow(at.ratio, n + 2);
+    const double fn = n;
+    for (int m = 0; m <= n; ++m, ++k) {
+      const double g = rr * gh[l];
+      if (m == 0) {
+        xc[0] += g * q[k];
+        zc[0] -= g * p[k];
+        l += 1;
+        continue;
+      }
+      const double h = rr * gh[l + 1];
+      const double dy = at.clat > 0 ? m * p[k] / ((fn + 1.0) * at.clat)
+                                    : q[k] * at.slat;
+      xc[m] += g * q[k];
+      xs[m] += h * q[k];
+      yc[m] -= h * dy;
+      ys[m] += g * dy;
+      zc[m] -= g * p[k];
+      zs[m] -= h * p[k];
+      l += 2;
+    }
+  }
+
+  const double* sin_m = meridians.sin_m.data();
+  const double* cos_m = meridians.cos_m.data();
+  double x[kRowTile], y[kRowTile], z[kRowTile];
+  for (size_t begin = 0; begin < count; begin += kRowTile) {
+    const size_t width = std::min(kRowTile, count - begin);
+    for (size_t j = 0; j < width; ++j) {
+      x[j] = xc[0];
+      y[j] = 0.0;
+      z[j] = zc[0];
+    }
+    for (int m = 1; m <= degree; ++m) {
+      const double* s = sin_m + m * count + begin;
+      const double* c = cos_m + m * count + begin;
+      for (size_t j = 0; j < width; ++j) {
+        x[j] += xc[m] * c[j] + xs[m] * s[j];
+        y[j] += yc[m] * c[j] + ys[m] * s[j];
+        z[j] += zc[m] * c[j] + zs[m] * s[j];
+      }
+    }
+    for (size_t j = 0; j < width; ++j) {
+      Field field;
+      field.x = x[j] * at.cd + z[j] * at.sd;
+      field.y = y[j];
+      field.z = z[j] * at.cd - x[j] * at.sd;
+      FillResult(at, field, Resolve(field), &results[begin + j]);
+    }
+  }
+  return TruncationBound(coefficients, degree, at.ratio);
+}
+
+void IGRFModel::ComputeBatch(const igrf_request* requests, size_t count,
+                             igrf_computation* computations) const {
+  std::vector<Request> numeric(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (!ParseDate(requests[i].date, &numeric[i].sdate)) {
+      numeric[i].sdate = std::numeric_limits<double>::quiet_NaN();
+    }
+    numeric[i].coord_type = requests[i].coord_type;
+    numeric[i].altitude_type = requests[i].altitude_type;
+    numeric[i].altitude = requests[i].altitude;
+    numeric[i].latitude = requests[i].latitude;
+    numeric[i].longitude = requests[i].longitude;
+  }
+  ComputeBatch(numeric.data(), count, computations);
+}
@@ -0,0 +1,221 @@
+/**
+ * @file igrf_model.h
+ * @brief In-process copy of the spherical harmonic model behind igrf_compute
+ *
+ * Keeps every epoch of a .COF file resident, so that the Gauss coefficients
+ * for a date are interpolated once and then reused for every point that
+ * shares that date. Interpolation, synthesis and the D/I/H/F resolution
+ * follow geomag70 (interpsh/extrapsh, shval3, dihf). libigrf itself is no
+ * longer linked into the server, but its header stays: requests and results
+ * are geomag70's own igrf_request and igrf_computation, so that
+ * igrf_model_test can hand the same structs to igrf_compute and compare
+ * every field.
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "igrf/include/geomag70.h"
+
+class IGRFModel {
+ public:
+  static constexpr int kMaxDegree = 13;
+  static constexpr size_t kCacheLine = 64;
+
+  static constexpr int kOk = 0;
+  static constexpr int kBadDate = 1;
+  static constexpr int kDateOutOfRange = 2;
+
+  // Main field coefficients interpolated to a single decimal year, together
+  // with the set one year later that the secular variation is derived from.
+  // Layout per degree n: g(n,0), g(n,1), h(n,1), ..., g(n,n), h(n,n).
+  struct Coefficients {
+    double sdate = 0;
+    int nmax = 0;
+    int error_code = kOk;
+    std::vector<double> gh;
+    std::vector<double> gh_next;
+    // Index n: sqrt((n + 1) * (2n + 1) * sum of the squared degree-n
+    // coefficients), the largest field degree n can produce at the
+    // reference radius.
+    std::vector<double> degree_bound;
+  };
+
+  // Geocentric position terms shared by every synthesis at one location.
+  struct Locus {
+    double slat;
+    double clat;
+    double sin_lon;
+    double cos_lon;
+    double ratio;  // earth radius / geocentric radius
+    double cd;     // rotation back to the geodetic frame
+    double sd;
+    bool at_pole;
+  };
+
+  struct Field {
+    double x;
+    double y;
+    double z;
+  };
+
+  // A fixed location with its date-independent terms precomputed. The field
+  // is linear in the coefficients, so the site keeps the contribution of
+  // every coefficient l up to kMaxDegree (x[l], y[l], z[l], geodetic frame)
+  // and evaluating it for a date is a dot product with gh.
+  struct Site {
+    Locus at;
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+  };
+
+  // sin(m * lon) and cos(m * lon), m = 0..kMaxDegree, for a row of
+  // longitudes: the longitude-dependent part of the synthesis, shared by
+  // every row of a grid. Entry m * count + j belongs to longitude j.
+  struct Meridians {
+    size_t count = 0;
+    std::vector<double> sin_m;
+    std::vector<double> cos_m;
+  };
+
+  // igrf_request with the date already resolved to a decimal year, so
+  // filling one takes neither a heap allocation nor string formatting.
+  struct Request {
+    double sdate;
+    char coord_type;     // 'D' geodetic, 'C' geocentric
+    char altitude_type;  // 'K' kilometers, 'M' meters, 'F' feet
+    double altitude;
+    double latitude;
+    double longitude;
+  };
+
+  IGRFModel() = default;
+  ~IGRFModel();
+  IGRFModel(const IGRFModel&) = delete;
+  IGRFModel& operator=(const IGRFModel&) = delete;
+
+  // Reads a .COF file in the format used by geomag70.
+  bool Load(const std::string& path);
+
+  // Writes the loaded coefficients as a binary image (see
+  // igrf_cof_compiler), replacing `path` atomically.
+  bool SaveImage(const std::string& path) const;
+  // Maps an image written by SaveImage read-only. Nothing is parsed or
+  // copied, and every process mapping the same image shares its pages.
+  bool LoadImage(const std::string& path);
+
+  double MinDate() const;
+  double MaxDate() const;
+
+  // Fills `coefficients` for `sdate` (decimal year). On failure the error
+  // code is left in coefficients->error_code and false is returned.
+  bool Interpolate(double sdate, Coefficients* coefficients) const;
+
+  // Evaluates `count` requests, interpolating the coefficients once per
+  // distinct date rather than once per request. A positive `max_degree`
+  // below the model's own stops the expansion there, and
+  // `truncation_bounds`, when given, receives for every request an upper
+  // bound in nT on the magnitude of the field left out.
+  void ComputeBatch(const Request* requests, size_t count,
+                    igrf_computation* computations, int max_degree = 0,
+                    double* truncation_bounds = nullptr) const;
+  // Evaluates `site` at each of `count` dates, with the same degree and
+  // bound semantics as ComputeBatch.
+  void ComputeSite(const Site& site, const double* sdates, size_t count,
+                   igrf_computation* computations, int max_degree = 0,
+                   double* truncation_bounds = nullptr) const;
+  // Same as the first ComputeBatch, for requests carrying a geomag70 "Y,M,D" or decimal year string.
+  void ComputeBatch(const igrf_request* requests, size_t count,
+                    igrf_computation* computations) const;
+
+  static bool ParseDate(const char* date, double* sdate);
+  static double DecimalYear(int year, int month, int day);
+
+  static Locus Locate(double latitude, double longitude,
+                      double altitude, bool geodetic);
+
+  // shval3 for two coefficient sets at once: the Legendre and longitude
+  // recursions are shared between the field and its value a year later.
+  static void Synthesize(const Locus& at, int nmax,
+                         const double* gh, const double* gh_next,
+                         Field* field, Field* field_next);
+
+  // Synthesize for `count` loci sharing one coefficient set. Runs the
+  // AVX-512 or AVX2 kernel when the CPU has one, evaluating 8 or 4 points
+  // per instruction, and Synthesize otherwise; the results agree with
+  // Synthesize to well below 1e-9 nT.
+  static void SynthesizeBatch(const Locus* at, size_t count, int nmax,
+                              const double* gh, const double* gh_next,
+                              Field* fields, Field* fields_next);
+
+  static Site PrepareSite(const Locus& at);
+
+  static void EvaluateSite(const Coefficients& coefficients,
+                           const Site& site, int max_degree,
+                           igrf_computation* computation,
+                           double* truncation_bound);
+
+  static Meridians PrepareMeridians(const double* longitudes, size_t count);
+
+  // Evaluates the main field at geodetic `latitude` and `altitude` (km) on
+  // every longitude of `meridians`, leaving the secular variation out. The
+  // Legendre terms are computed once for the row and folded into one sum
+  // per order m, so that each longitude costs a single pass over the
+  // orders. Returns the truncation bound of the row, the same for every
+  // longitude on it.
+  static double EvaluateRow(const Coefficients& coefficients, int max_degree,
+                            double latitude, double altitude,
+                            const Meridians& meridians,
+                            igrf_computation_result* results);
+
+  // Bound on the field of the degrees above `degree` at `ratio` (earth
+  // radius / geocentric radius).
+  static double TruncationBound(const Coefficients& coefficients,
+                                int degree, double ratio);
+
+  static void Evaluate(const Coefficients& coefficients,
+                       const Request& request,
+                       igrf_computation* computation);
+
+ private:
+  struct Epoch {
+    std::string name;
+    double epoch;
+    int max1;  // degree of the main field
+    int max2;  // degree of the secular variation
+    double yrmin;
+    double yrmax;
+    const double* main;  // max1 * (max1 + 2) values
+    const double* sv;    // max2 * (max2 + 2) values
+  };
+
+  // Evaluate up to `degree` for up to 64 requests that share
+  // `coefficients`. `bounds` may be null.
+  static void EvaluateBlock(const Coefficients& coefficients, int degree,
+                            const Request* const* requests, size_t count,
+                            igrf_computation* const* computations,
+                            double* const* bounds);
+
+  static void InterpolateEpochs(double date, const Epoch& first,
+                                const Epoch& second, std::vector<double>* gh);
+  static void ExtrapolateEpoch(double date, const Epoch& epoch,
+                               std::vector<double>* gh);
+
+  void Release();
+
+  std::vector<Epoch> epochs_;
+  struct AlignedFree {
+    void operator()(double* values) const;
+  };
+
+  // Backs the coefficients of epochs_: filled by Load, or left empty when
+  // they live in the image mapped by LoadImage. Either way every epoch's
+  // coefficients start on a cache line.
+  std::unique_ptr<double[], AlignedFree> storage_;
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+};
@@ -0,0 +1,190 @@
+// Vectorized Synthesize: the same shval3 recursion, with every variable that
+// depends on the location widened to one lane per point. The order of the
+// arithmetic follows IGRFModel::Synthesize term by term so that each lane
+// reproduces the scalar result.
+#include "igrf_model.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr int kMaxDegree = IGRFModel::kMaxDegree;
+constexpr int kMaxTerms = kMaxDegree * (kMaxDegree + 3) / 2;
+constexpr int kMaxWidth = 8;
+
+using KernelFn = void (*)(const IGRFModel::Locus* at, int nmax,
+                          const double* gh, const double* gh_next,
+                          IGRFModel::Field* fields,
+                          IGRFModel::Field* fields_next);
+
+struct Kernel {
+  KernelFn run;
+  size_t width;
+};
+
+void ScalarKernel(const IGRFModel::Locus* at, int nmax, const double* gh,
+                  const double* gh_next, IGRFModel::Field* fields,
+                  IGRFModel::Field* fields_next) {
+  IGRFModel::Synthesize(*at, nmax, gh, gh_next, fields, fields_next);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+// Evaluates W points; V is a GCC vector of W doubles and M the matching
+// comparison mask. Always inlined so that it is compiled for the target of
+// the kernel that instantiates it.
+template <typename V, typename M, int W>
+__attribute__((always_inline)) inline void SynthesizeLanes(
+    const IGRFModel::Locus* at, int nmax, const double* gh,
+    const double* gh_next, IGRFModel::Field* fields,
+    IGRFModel::Field* fields_next) {
+  V p[kMaxTerms + 1], q[kMaxTerms + 1];
+  V sl[kMaxDegree + 1], cl[kMaxDegree + 1];
+  V slat, clat, cd, sd;
+  for (int i = 0; i < W; ++i) {
+    slat[i] = at[i].slat;
+    clat[i] = at[i].clat;
+    sl[1][i] = at[i].sin_lon;
+    cl[1][i] = at[i].cos_lon;
+    cd[i] = at[i].cd;
+    sd[i] = at[i].sd;
+  }
+  const V zero = {};
+  // clat is the cosine of the geocentric latitude. Off the polar axis the
+  // east component divides by it; on the axis it takes shval3's limit form,
+  // as in Synthesize.
+  const M off_pole = clat > zero;
+  const double sqrt3 = std::sqrt(3.0);
+  sl[0] = zero;
+  cl[0] = zero + 1.0;
+  p[1] = 2.0 * slat;
+  p[2] = 2.0 * clat;
+  p[3] = 4.5 * slat * slat - 1.5;
+  p[4] = 3.0 * sqrt3 * clat * slat;
+  q[1] = -clat;
+  q[2] = slat;
+  q[3] = -3.0 * clat * slat;
+  q[4] = sqrt3 * (slat * slat - clat * clat);
+
+  V ax = zero, ay = zero, az = zero;
+  V bx = zero, by = zero, bz = zero;
+  const int npq = nmax * (nmax + 3) / 2;
+  int l = 0, n = 0, m = 1;
+  V rr = zero;
+  double fn = 0;
+  for (int k = 1; k <= npq; ++k) {
+    if (n < m) {
+      m = 0;
+      ++n;
+      for (int i = 0; i < W; ++i) rr[i] = std::pow(at[i].ratio, n + 2);
+      fn = n;
+    }
+    const double fm = m;
+    if (k >= 5) {
+      if (m == n) {
+        const double aa = std::sqrt(1.0 - 0.5 / fm);
+        const int j = k - n - 1;
+        p[k] = (1.0 + 1.0 / fm) * aa * clat * p[j];
+        q[k] = aa * (clat * q[j] + slat / fm * p[j]);
+        sl[m] = sl[m - 1] * cl[1] + cl[m - 1] * sl[1];
+        cl[m] = cl[m - 1] * cl[1] - sl[m - 1] * sl[1];
+      } else {
+        const double aa = std::sqrt(fn * fn - fm * fm);
+        const double bb = std::sqrt((fn - 1.0) * (fn - 1.0) - fm * fm) / aa;
+        const double cc = (2.0 * fn - 1.0) / aa;
+        const int ii = k - n;
+        const int j = k - 2 * n + 1;
+        p[k] = (fn + 1.0) * (cc * slat / fn * p[ii] - bb / (fn - 1.0) * p[j]);
+        q[k] = cc * (slat * q[ii] - clat / fn * p[ii]) - bb * q[j];
+      }
+    }
+    if (m == 0) {
+      const V ga = rr * gh[l], gb = rr * gh_next[l];
+      ax += ga * q[k];
+      az -= ga * p[k];
+      bx += gb * q[k];
+      bz -= gb * p[k];
+      l += 1;
+    } else {
+      const V ga = rr * gh[l], ha = rr * gh[l + 1];
+      const V gb = rr * gh_next[l], hb = rr * gh_next[l + 1];
+      const V ca = ga * cl[m] + ha * sl[m];
+      const V cb = gb * cl[m] + hb * sl[m];
+      ax += ca * q[k];
+      az -= ca * p[k];
+      bx += cb * q[k];
+      bz -= cb * p[k];
+      const V dy = off_pole ? fm * p[k] / ((fn + 1.0) * clat) : q[k] * slat;
+      ay += (ga * sl[m] - ha * cl[m]) * dy;
+      by += (gb * sl[m] - hb * cl[m]) * dy;
+      l += 2;
+    }
+    ++m;
+  }
+  const V x = ax * cd + az * sd, z = az * cd - ax * sd;
+  const V x_next = bx * cd + bz * sd, z_next = bz * cd - bx * sd;
+  for (int i = 0; i < W; ++i) {
+    fields[i] = {x[i], ay[i], z[i]};
+    fields_next[i] = {x_next[i], by[i], z_next[i]};
+  }
+}
+
+typedef double V4 __attribute__((vector_size(32)));
+typedef long long M4 __attribute__((vector_size(32)));
+typedef double V8 __attribute__((vector_size(64)));
+typedef long long M8 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2,fma"))) void Avx2Kernel(
+    const IGRFModel::Locus* at, int nmax, const double* gh,
+    const double* gh_next, IGRFModel::Field* fields,
+    IGRFModel::Field* fields_next) {
+  SynthesizeLanes<V4, M4, 4>(at, nmax, gh, gh_next, fields, fields_next);
+}
+
+__attribute__((target("avx512f"))) void Avx512Kernel(
+    const IGRFModel::Locus* at, int nmax, const double* gh,
+    const double* gh_next, IGRFModel::Field* fields,
+    IGRFModel::Field* fields_next) {
+  SynthesizeLanes<V8, M8, 8>(at, nmax, gh, gh_next, fields, fields_next);
+}
+
+Kernel SelectKernel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return {Avx512Kernel, 8};
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {Avx2Kernel, 4};
+  }
+  return {ScalarKernel, 1};
+}
+
+#else
+
+Kernel SelectKernel() {
+  return {ScalarKernel, 1};
+}
+
+#endif
+
+}  // namespace
+
+void IGRFModel::SynthesizeBatch(const Locus* at, size_t count, int nmax,
+                                const double* gh, const double* gh_next,
+                                Field* fields, Field* fields_next) {
+  static const Kernel kernel = SelectKernel();
+  size_t i = 0;
+  for (; i + kernel.width <= count; i += kernel.width) {
+    kernel.run(at + i, nmax, gh, gh_next, fields + i, fields_next + i);
+  }
+  if (i == count) return;
+  // Pad the tail with copies of its last point to fill a whole vector.
+  Locus tail[kMaxWidth];
+  Field tail_fields[kMaxWidth], tail_fields_next[kMaxWidth];
+  const size_t rest = count - i;
+  for (size_t j = 0; j < kernel.width; ++j) {
+    tail[j] = at[i + std::min(j, rest - 1)];
+  }
+  kernel.run(tail, nmax, gh, gh_next, tail_fields, tail_fields_next);
+  std::copy(tail_fields, tail_fields + rest, fields + i);
+  std::copy(tail_fields_next, tail_fields_next + rest, fields_next + i);
+}
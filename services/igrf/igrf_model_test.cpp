@@ -0,0 +1,206 @@
+/**
+ * @file igrf_model_test.cpp
+ * @brief In-process tests of IGRFModel: its agreement with geomag70, its
+ * synthesis kernels and its images
+ */
+#include "igrf_model.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "igrf/include/geomag70.h"
+
+#define CATCH_CONFIG_MAIN
+#include "../testing/catch.hpp"
+
+namespace {
+
+IGRFModel::Coefficients Coefficients(const IGRFModel& model, double sdate) {
+  IGRFModel::Coefficients coefficients;
+  REQUIRE(model.Interpolate(sdate, &coefficients));
+  return coefficients;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+std::string WriteFile(const std::string& path, const std::string& bytes) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes;
+  return path;
+}
+
+void RequireSame(const igrf_computation& expected,
+                 const igrf_computation& actual) {
+  const igrf_computation_result& e = expected.result;
+  const igrf_computation_result& a = actual.result;
+  REQUIRE(a.sdate == Approx(e.sdate).epsilon(1e-12));
+  REQUIRE(a.has_x == e.has_x);
+  REQUIRE(a.has_declination == e.has_declination);
+  if (e.has_x) REQUIRE(a.x == Approx(e.x).margin(1e-6));
+  REQUIRE(a.y == Approx(e.y).margin(1e-6));
+  REQUIRE(a.z == Approx(e.z).margin(1e-6));
+  REQUIRE(a.horizontal_intensity ==
+          Approx(e.horizontal_intensity).margin(1e-6));
+  REQUIRE(a.total_intensity == Approx(e.total_intensity).margin(1e-6));
+  if (e.has_declination) {
+    REQUIRE(a.declination == Approx(e.declination).margin(1e-9));
+  }
+  REQUIRE(a.inclination == Approx(e.inclination).margin(1e-9));
+
+  const igrf_computation_secular_variance& ev = expected.variance;
+  const igrf_computation_secular_variance& av = actual.variance;
+  REQUIRE(av.has_x == ev.has_x);
+  REQUIRE(av.has_declination == ev.has_declination);
+  if (ev.has_x) REQUIRE(av.x_dot == Approx(ev.x_dot).margin(1e-6));
+  REQUIRE(av.y_dot == Approx(ev.y_dot).margin(1e-6));
+  REQUIRE(av.z_dot == Approx(ev.z_dot).margin(1e-6));
+  REQUIRE(av.horizontal_intensity_dot ==
+          Approx(ev.horizontal_intensity_dot).margin(1e-6));
+  REQUIRE(av.total_intensity_dot ==
+          Approx(ev.total_intensity_dot).margin(1e-6));
+  if (ev.has_declination) {
+    REQUIRE(av.declination_dot == Approx(ev.declination_dot).margin(1e-6));
+  }
+  REQUIRE(av.inclination_dot == Approx(ev.inclination_dot).margin(1e-6));
+}
+
+}  // namespace
+
+// libigrf, the geomag70 build igrf_server used to call, is the reference
+// for the port.
+TEST_CASE("ComputeBatch agrees with geomag70's igrf_compute",
+          "[igrf_model]") {
+  IGRFModel model;
+  REQUIRE(model.Load("./IGRF13.COF"));
+  igrf_construct("./IGRF13.COF");
+
+  // Both ends of the model, a date past its last epoch that extrapolates
+  // with the secular variation, one in Y,M,D form and two out of range.
+  const std::vector<std::string> dates = {
+      "1900.0", "1962.25", "2019.99", "2020.0", "2022.7",
+      "2025.0", "2021,3,15", "1899.9", "2025.5"};
+  struct Position {
+    double latitude;
+    double longitude;
+    double altitude;  // km
+  };
+  const std::vector<Position> positions = {
+      {0.0, 0.0, 0.0},       {45.5, -73.6, 100.0}, {-33.9, 151.2, 0.5},
+      {90.0, 0.0, 0.0},      {-90.0, 120.0, 300.0}, {89.9999, 10.0, 10.0},
+      {12.0, 200.0, 35786.0}};
+  // Altitudes in each unit igrf_request takes.
+  const std::vector<std::pair<char, double>> units = {
+      {'K', 1.0}, {'M', 1000.0}, {'F', 1000.0 / 0.3048}};
+
+  for (const std::string& date : dates) {
+    for (char coord_type : {'D', 'C'}) {
+      for (const auto& unit : units) {
+        for (const Position& position : positions) {
+          std::vector<char> buffer(date.begin(), date.end());
+          buffer.push_back('\0');
+          igrf_request request;
+          request.date = buffer.data();
+          request.coord_type = coord_type;
+          request.altitude_type = unit.first;
+          // For 'C' this is a height above the 6371.2 km reference sphere.
+          request.altitude = position.altitude * unit.second;
+          request.latitude = position.latitude;
+          request.longitude = position.longitude;
+          INFO(date << " " << coord_type << " " << unit.first << " "
+                    << position.latitude << " " << position.longitude);
+
+          igrf_computation expected = {};
+          igrf_compute(&request, &expected);
+          igrf_computation actual = {};
+          model.ComputeBatch(&request, 1, &actual);
+          REQUIRE((actual.error_code == 0) == (expected.error_code == 0));
+          if (expected.error_code == 0) RequireSame(expected, actual);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("SynthesizeBatch agrees with Synthesize", "[igrf_model]") {
+  IGRFModel model;
+  REQUIRE(model.Load("./IGRF13.COF"));
+  const IGRFModel::Coefficients coefficients = Coefficients(model, 2020.5);
+
+  // 37 points leave a partial vector at either width; the poles take the
+  // kernel's special case.
+  std::mt19937_64 random(7);
+  std::uniform_real_distribution<double> latitude(-90.0, 90.0);
+  std::uniform_real_distribution<double> longitude(-180.0, 180.0);
+  std::uniform_real_distribution<double> altitude(0.0, 2000.0);
+  std::vector<IGRFModel::Locus> loci;
+  for (int i = 0; i < 37; ++i) {
+    const double at = i == 0 ? 90.0 : i == 1 ? -90.0 : latitude(random);
+    loci.push_back(IGRFModel::Locate(at, longitude(random), altitude(random),
+                                     i % 3 != 0));
+  }
+  std::vector<IGRFModel::Field> fields(loci.size());
+  std::vector<IGRFModel::Field> fields_next(loci.size());
+  IGRFModel::SynthesizeBatch(loci.data(), loci.size(), coefficients.nmax,
+                             coefficients.gh.data(),
+                             coefficients.gh_next.data(), fields.data(),
+                             fields_next.data());
+  for (size_t i = 0; i < loci.size(); ++i) {
+    IGRFModel::Field field, field_next;
+    IGRFModel::Synthesize(loci[i], coefficients.nmax, coefficients.gh.data(),
+                          coefficients.gh_next.data(), &field, &field_next);
+    // Within 1e-9 nT.
+    REQUIRE(std::abs(fields[i].x - field.x) < 1e-9);
+    REQUIRE(std::abs(fields[i].y - field.y) < 1e-9);
+    REQUIRE(std::abs(fields[i].z - field.z) < 1e-9);
+    REQUIRE(std::abs(fields_next[i].x - field_next.x) < 1e-9);
+    REQUIRE(std::abs(fields_next[i].y - field_next.y) < 1e-9);
+    REQUIRE(std::abs(fields_next[i].z - field_next.z) < 1e-9);
+  }
+}
+
+TEST_CASE("Images round-trip and bad ones are refused", "[igrf_model]") {
+  IGRFModel model;
+  REQUIRE(model.Load("./IGRF13.COF"));
+  REQUIRE(model.SaveImage("./roundtrip.img"));
+  IGRFModel mapped;
+  REQUIRE(mapped.LoadImage("./roundtrip.img"));
+
+  SECTION("The mapped model interpolates the same coefficients to the bit") {
+    REQUIRE(mapped.MinDate() == model.MinDate());
+    REQUIRE(mapped.MaxDate() == model.MaxDate());
+    for (double sdate : {1900.0, 1962.25, 2000.0, 2020.5, 2024.9}) {
+      const IGRFModel::Coefficients saved = Coefficients(model, sdate);
+      const IGRFModel::Coefficients loaded = Coefficients(mapped, sdate);
+      REQUIRE(loaded.nmax == saved.nmax);
+      REQUIRE(loaded.gh == saved.gh);
+      REQUIRE(loaded.gh_next == saved.gh_next);
+    }
+  }
+
+  SECTION("Truncated, corrupt and missing images leave the model as it was") {
+    const std::string image = ReadFile("./roundtrip.img");
+    std::string magic = image, degree = image;
+    magic[0] = 'X';
+    // max1 of the first epoch record, after the 32-byte header, its 16-byte
+    // name and three doubles.
+    const int32_t too_high = IGRFModel::kMaxDegree + 1;
+    std::memcpy(&degree[32 + 16 + 24], &too_high, sizeof(too_high));
+    REQUIRE_FALSE(mapped.LoadImage(
+        WriteFile("./truncated.img", image.substr(0, image.size() / 2))));
+    REQUIRE_FALSE(
+        mapped.LoadImage(WriteFile("./truncated.img", image.substr(0, 16))));
+    REQUIRE_FALSE(mapped.LoadImage(WriteFile("./corrupt.img", magic)));
+    REQUIRE_FALSE(mapped.LoadImage(WriteFile("./corrupt.img", degree)));
+    REQUIRE_FALSE(mapped.LoadImage("./missing.img"));
+    REQUIRE(Coefficients(mapped, 2020.5).gh == Coefficients(model, 2020.5).gh);
+  }
+}
@@ -17,14 +17,26 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "google/protobuf/arena.h"
+#include "grpcpp/alarm.h"
 #include "grpcpp/channel.h"
 #include "grpcpp/client_context.h"
+#include "grpcpp/completion_queue.h"
 #include "grpcpp/create_channel.h"
 #include "grpcpp/server.h"
 #include "grpcpp/server_builder.h"
@@ -35,9 +47,20 @@
 #include "sgp_service.grpc.pb.h"
 #include "sgp4/include/Tle.h"
 #include "sgp4/include/SGP4.h"
+#include "sgp4/include/Eci.h"
+#include "sgp4/include/Util.h"
 #include "noise_application.h"
-#include "igrf/include/geomag70.h"
+#include "ephemeris_cache.h"
+#include "igrf_model.h"
+#include "model_registry.h"
+#include "result_cache.h"
+#include "satellite_registry.h"
+#include "geodetic_batch.h"
+#include "sgp4_batch.h"
+#include "thread_pool.h"
 
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
@@ -62,6 +85,20 @@ using IGRF::EndRequest;
 using IGRF::EndResponse;
 using IGRF::Point;
 using IGRF::PointResult;
+using IGRF::SiteRequest;
+using IGRF::SiteResponse;
+using IGRF::SiteReleaseRequest;
+using IGRF::ModelReloadRequest;
+using IGRF::ModelReloadResponse;
+using IGRF::CacheStatsRequest;
+using IGRF::CacheStatsResponse;
+using IGRF::GridAxis;
+using IGRF::PointColumns;
+using IGRF::GridComponent;
+using IGRF::GridRequest;
+using IGRF::GridResult;
+using IGRF::ConstellationRequest;
+using IGRF::ConstellationResult;
 using IGRF::IGRFService;
 // using proto_computation_result = IGRF::igrf_computation_result;
 // using proto_computation_variance = IGRF::igrf_computation_secular_variance;
@@ -76,226 +113,1574 @@ float ConvertToRadians(float num) {
   return num * 3.1415926 /180;
 }
 
+// Decimal year of the day containing `ticks`, the resolution the "Y,M,D"
+// dates of igrf_request used to have.
+double DecimalYearOf(uint64_t ticks) {
+  DateTime date(ticks);
+  int year = 0, month = 0, day = 0;
+  date.FromTicks(year, month, day);
+  return IGRFModel::DecimalYear(year, month, day);
+}
+
 
-class IGRFServiceImpl : public IGRFService::Service {
+// igrf_server runs on the asynchronous gRPC API: a fixed number of threads
+// poll the completion queues, and every RPC is a Call object whose
+// Proceed() is invoked each time one of its operations completes. RPCs
+// that depend on the SGP service issue the downstream call on the same
+// completion queue, so no thread is held while SGP computes.
+class IGRFServiceImpl {
  public:
-  explicit IGRFServiceImpl(std::shared_ptr<Channel> channel)
-      : stub_(SGPService::NewStub(channel)) {
+  // A `cache_size` of 0 disables the result cache, and an
+  // `ephemeris_budget` of 0 bytes the ephemeris cache. With `satellites`,
+  // construct, computeTLE, computeTLEStream and endWork propagate in
+  // process and the SGP service behind `channel` is never called.
+  IGRFServiceImpl(std::shared_ptr<Channel> channel,
+                  ModelRegistry* models,
+                  ThreadPool* pool,
+                  size_t cache_size,
+                  size_t ephemeris_budget,
+                  SatelliteRegistry* satellites = nullptr)
+      : stub_(SGPService::NewStub(channel)), models_(models), pool_(pool),
+        satellites_(satellites) {
+    if (cache_size > 0) {
+      cache_ = std::make_unique<ResultCache>(cache_size, kCacheShards);
+    }
+    if (ephemeris_budget > 0) {
+      ephemeris_ =
+          std::make_unique<EphemerisCache>(ephemeris_budget, kCacheShards);
+    }
   }
 
-  Status construct(ServerContext* context_,
-        const SGPConstructRequest* request,
-        SGPConstructResponse* response) {
-    ClientContext context;
-    Status status = stub_->SGPConstruct(&context, *request, response);
+  void Run(const std::string& server_address, size_t pollers, bool test);
+
+ private:
+  class Call;
+  template <class Request, class Response>
+  class UnaryCall;
+  template <class Request, class Response, class SGPRequest, class SGPResponse>
+  class RelayCall;
+  class TLEComputeCall;
+  class TLEStreamCall;
+  class ReloadCall;
+
+  static constexpr size_t kCacheShards = 16;
+
+  // Samples per SGP request, and per computeTLEStream message, when the
+  // request leaves chunk_size unset, and the most a chunk_size may ask for;
+  // larger ones are clamped.
+  static constexpr size_t kStreamChunk = 4096;
+  static constexpr size_t kMaxChunk = 16384;
+  // SGP chunks a computeTLE call has fetched or is fetching but not yet
+  // evaluated.
+  static constexpr size_t kPipelineDepth = 4;
+  // Standard deviation, km, of the position noise of --sgp=local.
+  static constexpr double kSGPNoise = 1.0;
+
+  void Poll(grpc::ServerCompletionQueue* cq);
+  void StartCalls(grpc::ServerCompletionQueue* cq);
+
+  ///////////////
+  Status construct(const SGPConstructRequest* request,
+                   SGPConstructRequest* SGPRequest) {
+    *SGPRequest = *request;
+    return Status::OK;
+  }
+
+  Status constructed(const SGPConstructRequest* request,
+                     const Status& status,
+                     const SGPConstructResponse* SGPResponse,
+                     SGPConstructResponse* response) {
+    *response = *SGPResponse;
+    if (status.ok()) RememberTLE(SGPResponse->computational_id(), *request);
     return status;
   }
 
+  // construct for --sgp=local. Observer locations are not used here.
+  Status constructLocally(const SGPConstructRequest* request,
+                          SGPConstructResponse* response) {
+    std::string error;
+    std::string id = satellites_->Add(request->title(), request->first(),
+                                      request->second(), &error);
+    if (id.empty()) return Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+    response->set_computational_id(id);
+    RememberTLE(id, *request);
+    return Status::OK;
+  }
+
+  // Which TLE a computational id stands for, as far as ephemeris_ goes.
+  void RememberTLE(const std::string& computational_id,
+                   const SGPConstructRequest& tle) {
+    if (!ephemeris_) return;
+    EphemerisCache::Key key =
+        EphemerisCache::MakeKey(tle.first(), tle.second());
+    std::lock_guard<std::mutex> lock(tles_mutex_);
+    tles_[computational_id] = std::move(key);
+  }
 
-  Status computeForPoint(ServerContext* context_,
-              const Point* dot,
-              PointResult* dot_res) {
+  void ForgetTLE(const std::string& computational_id) {
+    std::lock_guard<std::mutex> lock(tles_mutex_);
+    tles_.erase(computational_id);
+  }
+
+  ///////////////
+  Status computeForPoint(const Point* dot, PointResult* dot_res) {
+    if (!dot->site_id().empty()) return computeForSite(dot, dot_res);
+    std::vector<IGRFModel::Request> requests;
+    requests.reserve(dot->coord_size());
     for (auto& coord : dot->coord()) {
-      uint64_t time = coord.encoded_time();
-      // std::cout << "acc " << time;
-      DateTime date(time);
-      int year = 0, month = 0, day = 0;
-      date.FromTicks(year, month, day);
-      std::string str_date;
-      str_date = std::to_string(year) + ","
-          + std::to_string(month) + ","
-          + std::to_string(day);
-      igrf_request IGRFrequest;
-      IGRFrequest.date = reinterpret_cast<char*>(malloc(str_date.length()+1));
-      snprintf(IGRFrequest.date, str_date.length()+1, "%s",  str_date.c_str());
+      IGRFModel::Request IGRFrequest;
+      IGRFrequest.sdate = DecimalYearOf(coord.encoded_time());
       IGRFrequest.coord_type = 'D';
       IGRFrequest.altitude_type = 'K';
       IGRFrequest.altitude = coord.alt();
       IGRFrequest.latitude = coord.lat();
       IGRFrequest.longitude = coord.lon();
-      igrf_computation IGRFcomputation;
-      igrf_compute(&IGRFrequest, &IGRFcomputation);
-      igrf_computation_result computation_result = IGRFcomputation.result;
-      igrf_computation_secular_variance variance = IGRFcomputation.variance;
-      std::cout << computation_result.y << "\n";
-      if (dot->add_noise_to_igrf()) {
-        GaussianNoise<PseudoNoiseMixin> noise(0, 50);
-        if (IGRFcomputation.result.has_x) {
-          computation_result.x += noise.Apply();
+      requests.push_back(IGRFrequest);
+    }
+    ModelRegistry::Reader models(*models_);
+    uint64_t serial = 0;
+    const IGRFModel* model = models.Find(dot->model_id(), &serial);
+    if (model == nullptr) return UnknownModel(dot->model_id());
+    return ComputeCachedPoints(*model, serial, requests,
+                               dot->add_noise_to_igrf(), dot->max_degree(),
+                               dot->columnar(), dot_res);
+  }
+
+  Status computeForSite(const Point* dot, PointResult* dot_res) {
+    if (dot->coord_size() > 0) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    "coord and site_id are mutually exclusive");
+    }
+    std::shared_ptr<const IGRFModel::Site> site;
+    {
+      std::lock_guard<std::mutex> lock(sites_mutex_);
+      auto it = sites_.find(dot->site_id());
+      if (it != sites_.end()) site = it->second;
+    }
+    if (!site) {
+      return Status(grpc::StatusCode::NOT_FOUND,
+                    "unknown site " + dot->site_id());
+    }
+    std::vector<double> sdates;
+    sdates.reserve(dot->encoded_time_size());
+    for (uint64_t ticks : dot->encoded_time()) {
+      sdates.push_back(DecimalYearOf(ticks));
+    }
+    ModelRegistry::Reader models(*models_);
+    const IGRFModel* model = models.Find(dot->model_id());
+    if (model == nullptr) return UnknownModel(dot->model_id());
+    return ComputeSite(*model, *site, sdates, dot->add_noise_to_igrf(),
+                       dot->max_degree(), dot->columnar(), dot_res);
+  }
+
+  ///////////////
+  Status computeGrid(const GridRequest* request, GridResult* response) {
+    std::vector<GridComponent> components;
+    for (int component : request->components()) {
+      if (!IGRF::GridComponent_IsValid(component)) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                      "unknown grid component " + std::to_string(component));
+      }
+      components.push_back(static_cast<GridComponent>(component));
+    }
+    if (components.empty()) {
+      for (int c = IGRF::GridComponent_MIN; c <= IGRF::GridComponent_MAX;
+           ++c) {
+        components.push_back(static_cast<GridComponent>(c));
+      }
+    }
+    // Every count is below 2^32, so none of the products can overflow.
+    const size_t columns = AxisSize(request->longitude());
+    const size_t stride = columns * components.size();
+    const size_t rows =
+        AxisSize(request->altitude()) * AxisSize(request->latitude());
+    if (stride > kMaxGridValues || rows > kMaxGridValues / stride) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    "grid exceeds " + std::to_string(kMaxGridValues) +
+                        " values");
+    }
+    const std::vector<double> latitudes = AxisValues(request->latitude());
+    const std::vector<double> longitudes = AxisValues(request->longitude());
+    const std::vector<double> altitudes = AxisValues(request->altitude());
+
+    ModelRegistry::Reader models(*models_);
+    const IGRFModel* model = models.Find(request->model_id());
+    if (model == nullptr) return UnknownModel(request->model_id());
+    IGRFModel::Coefficients coefficients;
+    model->Interpolate(DecimalYearOf(request->encoded_time()), &coefficients);
+    response->set_sdate(coefficients.sdate);
+    response->set_error_code(coefficients.error_code);
+    if (coefficients.error_code != IGRFModel::kOk) return Status::OK;
+
+    const int degree =
+        std::min<uint32_t>(request->max_degree(), IGRFModel::kMaxDegree);
+    const IGRFModel::Meridians meridians =
+        IGRFModel::PrepareMeridians(longitudes.data(), columns);
+    response->mutable_values()->Resize(rows * stride, 0.0f);
+    float* values = response->mutable_values()->mutable_data();
+    std::vector<double> bounds(rows);
+    auto fill = [&](size_t begin, size_t end) {
+      std::vector<igrf_computation_result> results(columns);
+      for (size_t row = begin; row < end; ++row) {
+        bounds[row] = IGRFModel::EvaluateRow(
+            coefficients, degree, latitudes[row % latitudes.size()],
+            altitudes[row / latitudes.size()], meridians, results.data());
+        float* out = values + row * stride;
+        for (const igrf_computation_result& result : results) {
+          for (GridComponent component : components) {
+            *out++ = GridValue(result, component);
+          }
         }
-        computation_result.y += noise.Apply();
-        computation_result.z += noise.Apply();
-        if (IGRFcomputation.result.has_declination) {
-          computation_result.declination += noise.Apply();
+      }
+    };
+    if (pool_ != nullptr && rows * columns > kParallelChunk) {
+      pool_->ParallelFor(rows, std::max<size_t>(1, kParallelChunk / columns),
+                         fill);
+    } else {
+      fill(0, rows);
+    }
+    response->set_truncation_error(
+        *std::max_element(bounds.begin(), bounds.end()));
+    return Status::OK;
+  }
+
+  static size_t AxisSize(const GridAxis& axis) {
+    return std::max<uint32_t>(axis.count(), 1);
+  }
+
+  static std::vector<double> AxisValues(const GridAxis& axis) {
+    std::vector<double> values(AxisSize(axis));
+    for (size_t i = 0; i < values.size(); ++i) {
+      values[i] = axis.start() + axis.step() * i;
+    }
+    return values;
+  }
+
+  static float GridValue(const igrf_computation_result& result,
+                         GridComponent component) {
+    constexpr float undefined = std::numeric_limits<float>::quiet_NaN();
+    switch (component) {
+      case IGRF::GRID_X:
+        return result.has_x ? result.x : undefined;
+      case IGRF::GRID_Y:
+        return result.y;
+      case IGRF::GRID_Z:
+        return result.z;
+      case IGRF::GRID_DECLINATION:
+        return result.has_declination ? result.declination : undefined;
+      case IGRF::GRID_INCLINATION:
+        return result.inclination;
+      case IGRF::GRID_HORIZONTAL_INTENSITY:
+        return result.horizontal_intensity;
+      case IGRF::GRID_TOTAL_INTENSITY:
+        return result.total_intensity;
+      default:
+        return undefined;
+    }
+  }
+
+  ///////////////
+  Status registerSite(const SiteRequest* request, SiteResponse* response) {
+    const SGP::CoordGeodetic& coord = request->coord();
+    auto site = std::make_shared<const IGRFModel::Site>(
+        IGRFModel::PrepareSite(IGRFModel::Locate(
+            coord.lat(), coord.lon(), coord.alt(), true)));
+    std::lock_guard<std::mutex> lock(sites_mutex_);
+    std::string id = "site-" + std::to_string(++last_site_);
+    sites_.emplace(id, std::move(site));
+    response->set_site_id(std::move(id));
+    return Status::OK;
+  }
+
+  Status releaseSite(const SiteReleaseRequest* request, EndResponse*) {
+    std::lock_guard<std::mutex> lock(sites_mutex_);
+    if (sites_.erase(request->site_id()) == 0) {
+      return Status(grpc::StatusCode::NOT_FOUND,
+                    "unknown site " + request->site_id());
+    }
+    return Status::OK;
+  }
+
+  ///////////////
+  Status cacheStats(const CacheStatsRequest*, CacheStatsResponse* response) {
+    if (cache_) {
+      response->set_capacity(cache_->capacity());
+      response->set_entries(cache_->size());
+      response->set_hits(cache_->hits());
+      response->set_misses(cache_->misses());
+      response->set_evictions(cache_->evictions());
+    }
+    if (ephemeris_) {
+      response->set_ephemeris_capacity(ephemeris_->capacity());
+      response->set_ephemeris_entries(ephemeris_->size());
+      response->set_ephemeris_hits(ephemeris_->hits());
+      response->set_ephemeris_misses(ephemeris_->misses());
+      response->set_ephemeris_evictions(ephemeris_->evictions());
+    }
+    return Status::OK;
+  }
+
+  ///////////////
+  // Each chunk of the set parses its own TLEs and propagates them, so the
+  // parsing is spread over the pool as well.
+  Status propagateConstellation(const ConstellationRequest* request,
+                                ConstellationResult* response) {
+    const size_t count = request->tles_size();
+    const DateTime date(static_cast<int64_t>(request->encoded_time()));
+    SGP4Constellation constellation(count);
+    SGP4Batch::States states;
+    states.Resize(count);
+    std::vector<std::string> errors(count);
+    auto propagate = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const SGPConstructRequest& tle = request->tles(i);
+        try {
+          constellation.Set(i, Tle(tle.title(), tle.first(), tle.second()));
+        } catch (const std::exception& e) {
+          errors[i] = e.what();
         }
-        computation_result.inclination += noise.Apply();
       }
+      constellation.Propagate(date, begin, end, &states, &errors);
+    };
+    if (pool_ != nullptr && count > kConstellationChunk) {
+      pool_->ParallelFor(count, kConstellationChunk, propagate);
+    } else {
+      propagate(0, count);
+    }
+    response->mutable_x()->Add(states.x.begin(), states.x.end());
+    response->mutable_y()->Add(states.y.begin(), states.y.end());
+    response->mutable_z()->Add(states.z.begin(), states.z.end());
+    response->mutable_vx()->Add(states.vx.begin(), states.vx.end());
+    response->mutable_vy()->Add(states.vy.begin(), states.vy.end());
+    response->mutable_vz()->Add(states.vz.begin(), states.vz.end());
+    for (size_t i = 0; i < count; ++i) {
+      if (errors[i].empty()) continue;
+      IGRF::ConstellationFailure* failure = response->add_failures();
+      failure->set_index(i);
+      failure->set_reason(errors[i]);
+    }
+    return Status::OK;
+  }
+
+  ///////////////
+  // Runs on a thread of its own, see ReloadCall.
+  Status reloadModel(const ModelReloadRequest* request,
+                     ModelReloadResponse* response) {
+    auto model = std::make_unique<IGRFModel>();
+    if (!model->LoadImage(request->path()) && !model->Load(request->path())) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    "cannot load a model from " + request->path());
+    }
+    response->set_min_date(model->MinDate());
+    response->set_max_date(model->MaxDate());
+    models_->Publish(request->model_id().empty() ? models_->default_id()
+                                                 : request->model_id(),
+                     std::move(model));
+    return Status::OK;
+  }
 
-      auto tmp_result = dot_res->add_result();  // tmp_result is a pointer
-      tmp_result->set_sdate(computation_result.sdate);
-      if (IGRFcomputation.result.has_declination) {
-        tmp_result->set_declination(computation_result.declination);
+  ///////////////
+  // The samples of a request are either listed in encoded_time or
+  // described by time_range, never both, and there are at most
+  // `max_samples` of them. A range steps forward and its last sample is
+  // still a DateTime tick, so no tick computed from it overflows.
+  static Status CheckSamples(const TLEComputeRequest& TLErequest,
+                             size_t max_samples) {
+    if (TLErequest.has_time_range() && TLErequest.encoded_time_size() > 0) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    "encoded_time and time_range are mutually exclusive");
+    }
+    if (TLErequest.has_time_range()) {
+      const SGP::TimeRange& range = TLErequest.time_range();
+      if (range.count() > max_samples) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                      "time_range exceeds " + std::to_string(max_samples) +
+                          " samples");
+      }
+      if (range.step() == 0) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                      "time_range step must be positive");
       }
-      tmp_result->set_inclination(computation_result.inclination);
-      if (IGRFcomputation.result.has_x) {
-        tmp_result->set_x(computation_result.x);
+      constexpr uint64_t kMaxTicks = std::numeric_limits<int64_t>::max();
+      if (range.count() > 0 &&
+          (range.start() > kMaxTicks ||
+           (range.count() - 1) > (kMaxTicks - range.start()) / range.step())) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                      "time_range runs past the last representable tick");
       }
-      tmp_result->set_y(computation_result.y);
-      tmp_result->set_z(computation_result.z);
+    }
+    const double tolerance = TLErequest.interpolation_tolerance();
+    if (!(tolerance >= 0.0) || std::isinf(tolerance)) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    "interpolation_tolerance must be a finite number >= 0");
+    }
+    return Status::OK;
+  }
 
-      tmp_result->set_horizontal_intensity(
-          computation_result.horizontal_intensity);
-      tmp_result->set_total_intensity(computation_result.total_intensity);
+  static size_t ChunkSize(const TLEComputeRequest& TLErequest) {
+    if (TLErequest.chunk_size() == 0) return kStreamChunk;
+    return std::min<size_t>(TLErequest.chunk_size(), kMaxChunk);
+  }
 
-      auto tmp_variance = dot_res->add_variance();  // tmp_result is a pointer
-      if (IGRFcomputation.variance.has_declination) {
-        tmp_variance->set_declination_dot(variance.declination_dot);
-      }
-      tmp_variance->set_inclination_dot(variance.inclination_dot);
-      if (IGRFcomputation.variance.has_x) {
-        tmp_variance->set_x_dot(variance.x_dot);
+  static size_t SampleCount(const TLEComputeRequest& TLErequest) {
+    return TLErequest.has_time_range()
+        ? TLErequest.time_range().count()
+        : TLErequest.encoded_time_size();
+  }
+
+  // Asks SGP for the samples [begin, end) of the request. A range stays a
+  // range, so the ticks are never materialized on this side.
+  static void PrepareSGPRequest(const TLEComputeRequest& TLErequest,
+                                size_t begin, size_t end,
+                                SGPComputeRequest* SGPRequest) {
+    SGPRequest->set_computational_id(TLErequest.computational_id());
+    if (TLErequest.has_time_range()) {
+      const SGP::TimeRange& range = TLErequest.time_range();
+      SGP::TimeRange* slice = SGPRequest->mutable_time_range();
+      slice->set_start(range.start() + begin * range.step());
+      slice->set_step(range.step());
+      slice->set_count(end - begin);
+    } else {
+      SGPRequest->mutable_encoded_time()->Reserve(end - begin);
+      for (size_t i = begin; i < end; ++i) {
+          SGPRequest->add_encoded_time(TLErequest.encoded_time(i));
       }
-      tmp_variance->set_y_dot(variance.y_dot);
-      tmp_variance->set_z_dot(variance.z_dot);
+    }
+    SGPRequest->set_coord_type(SGP::CoordType::GEODETIC);
+    SGPRequest->set_use_noise(TLErequest.add_noise_to_sgp());
+  }
 
-      tmp_variance->set_horizontal_intensity_dot(
-          variance.horizontal_intensity_dot);
-      tmp_variance->set_total_intensity_dot(variance.total_intensity_dot);
+  // The samples of a chunk ephemeris_ already holds, between
+  // LookupEphemeris and MergeEphemeris.
+  struct CachedSamples {
+    bool enabled = false;
+    EphemerisCache::Key key;
+    std::vector<int64_t> ticks;
+    std::vector<EphemerisCache::Value> values;
+    std::vector<char> hits;
+    size_t misses = 0;
+  };
 
-      dot_res->add_error_code(IGRFcomputation.error_code);
+  // Narrows `SGPRequest`, as PrepareSGPRequest made it for the samples
+  // [begin, end), down to those ephemeris_ lacks, and keeps the others in
+  // `cached`. Returns whether SGP is left anything to compute. Noisy
+  // samples are neither looked up nor, later, stored.
+  bool LookupEphemeris(const TLEComputeRequest& TLErequest, size_t begin,
+                       size_t end, SGPComputeRequest* SGPRequest,
+                       CachedSamples* cached) const {
+    cached->enabled = false;
+    if (!ephemeris_ || TLErequest.add_noise_to_sgp()) return true;
+    {
+      std::lock_guard<std::mutex> lock(tles_mutex_);
+      auto it = tles_.find(TLErequest.computational_id());
+      if (it == tles_.end()) return true;
+      cached->key = it->second;
+    }
+    cached->enabled = true;
+    // The SGP service always propagates every sample.
+    cached->key.tolerance =
+        satellites_ != nullptr ? TLErequest.interpolation_tolerance() : 0.0;
+    const size_t count = end - begin;
+    cached->ticks.resize(count);
+    cached->values.resize(count);
+    cached->hits.assign(count, 0);
+    cached->misses = 0;
+    const SGP::TimeRange& range = TLErequest.time_range();
+    for (size_t i = 0; i < count; ++i) {
+      cached->ticks[i] = TLErequest.has_time_range()
+          ? range.start() + (begin + i) * range.step()
+          : TLErequest.encoded_time(begin + i);
+      cached->key.ticks = cached->ticks[i];
+      cached->hits[i] = ephemeris_->Lookup(cached->key, &cached->values[i]);
+      if (!cached->hits[i]) ++cached->misses;
+    }
+    if (cached->misses == count) return true;
+    SGPRequest->clear_time_range();
+    SGPRequest->clear_encoded_time();
+    SGPRequest->mutable_encoded_time()->Reserve(cached->misses);
+    for (size_t i = 0; i < count; ++i) {
+      if (!cached->hits[i]) SGPRequest->add_encoded_time(cached->ticks[i]);
+    }
+    return cached->misses > 0;
+  }
+
+  // Stores the samples SGP answered for a chunk LookupEphemeris narrowed,
+  // and puts the cached ones back in their places. A response of the wrong
+  // size is left for the caller to reject.
+  void MergeEphemeris(CachedSamples* cached,
+                      SGPComputeResponse* SGPResponse) const {
+    if (!cached->enabled ||
+        SGPResponse->geodetic_size() != static_cast<int>(cached->misses)) {
+      return;
+    }
+    const size_t count = cached->ticks.size();
+    for (size_t i = 0, j = 0; i < count; ++i) {
+      if (cached->hits[i]) continue;
+      const SGP::CoordGeodetic& coord = SGPResponse->geodetic(j++);
+      cached->values[i] = {coord.lat(), coord.lon(), coord.alt()};
+      cached->key.ticks = cached->ticks[i];
+      ephemeris_->Insert(cached->key, cached->values[i]);
+    }
+    if (cached->misses == count) return;
+    SGPResponse->set_coord_type(SGP::CoordType::GEODETIC);
+    SGPResponse->clear_geodetic();
+    SGPResponse->mutable_geodetic()->Reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      SGP::CoordGeodetic* coord = SGPResponse->add_geodetic();
+      coord->set_lat(cached->values[i].latitude);
+      coord->set_lon(cached->values[i].longitude);
+      coord->set_alt(cached->values[i].altitude);
+      coord->set_encoded_time(cached->ticks[i]);
+    }
+  }
+
+  // Evaluates the samples of a successful SGP response.
+  Status computedTLE(const IGRFModel& model,
+                     const TLEComputeRequest* TLErequest,
+                     const SGPComputeResponse* SGPResponse,
+                     TLEComputeResponse* TLEresponse) {
+    const std::vector<IGRFModel::Request> requests = RequestsOf(*SGPResponse);
+    return ComputePoints(model, requests, TLErequest->add_noise_to_igrf(),
+                         TLErequest->max_degree(), TLErequest->columnar(),
+                         TLEresponse->mutable_results());
+  }
+
+  // SGPCompute for --sgp=local, geodetic coordinates only. Noise adds a
+  // Gaussian error of kSGPNoise km to each axis of the ECI position. A
+  // positive tolerance, in km, lets SGP4Batch::PropagateDense interpolate
+  // between propagated knots.
+  Status PropagateLocally(const SGPComputeRequest& SGPRequest,
+                          double tolerance,
+                          SGPComputeResponse* SGPResponse) const {
+    std::shared_ptr<const SGP4Batch> satellite =
+        satellites_->Find(SGPRequest.computational_id());
+    if (!satellite) return UnknownSatellite(SGPRequest.computational_id());
+    const bool ranged = SGPRequest.has_time_range();
+    const SGP::TimeRange& range = SGPRequest.time_range();
+    const size_t count =
+        ranged ? range.count() : SGPRequest.encoded_time_size();
+    std::vector<int64_t> ticks(count);
+    std::vector<double> tsince(count);
+    for (size_t i = 0; i < count; ++i) {
+      ticks[i] = ranged ? range.start() + i * range.step()
+                        : SGPRequest.encoded_time(i);
+      tsince[i] = satellite->MinutesSinceEpoch(DateTime(ticks[i]));
+    }
+    SGP4Batch::States states;
+    try {
+      satellite->PropagateDense(tsince.data(), count, tolerance, &states);
+    } catch (const std::exception& e) {
+      // SGP4 gives up on a decayed or otherwise unusable orbit.
+      return Status(grpc::StatusCode::FAILED_PRECONDITION, e.what());
+    }
+    if (SGPRequest.use_noise()) {
+      GaussianNoise<PseudoNoiseMixin> noise(0, kSGPNoise);
+      std::vector<double> deviates(3 * count);
+      noise.Fill(deviates.data(), deviates.size());
+      for (size_t i = 0; i < count; ++i) {
+        states.x[i] += deviates[3 * i];
+        states.y[i] += deviates[3 * i + 1];
+        states.z[i] += deviates[3 * i + 2];
+      }
+    }
+    GeodeticSeries geodetic;
+    EciToGeodetic(ticks.data(), states.x.data(), states.y.data(),
+                  states.z.data(), count, &geodetic);
+    SGPResponse->set_coord_type(SGP::CoordType::GEODETIC);
+    SGPResponse->mutable_geodetic()->Reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      SGP::CoordGeodetic* coord = SGPResponse->add_geodetic();
+      coord->set_lat(Util::RadiansToDegrees(geodetic.latitude[i]));
+      coord->set_lon(Util::RadiansToDegrees(geodetic.longitude[i]));
+      coord->set_alt(geodetic.altitude[i]);
+      coord->set_encoded_time(ticks[i]);
     }
     return Status::OK;
   }
-  ///////////////
 
-  Status computeTLE(ServerContext* context_,
-                    const TLEComputeRequest* TLErequest,
-                    TLEComputeResponse* TLEresponse) {
-    SGPComputeRequest SGPRequest;
-    SGPRequest.set_computational_id(TLErequest->computational_id());
-    for (auto& t : TLErequest->encoded_time()) {
-        SGPRequest.add_encoded_time(t);
-    }
-    SGPRequest.set_coord_type(SGP::CoordType::GEODETIC);
-    SGPRequest.set_use_noise(TLErequest->add_noise_to_sgp());
-    ClientContext client_context;
-    SGPComputeResponse SGPResponse;
-    Status status = stub_->SGPCompute(&client_context,
-                                      SGPRequest, &SGPResponse);
-    if (!status.ok())
-      std::cout << "SGPSTAT:" << status.error_code() << std::endl;
+  static Status UnknownSatellite(const std::string& computational_id) {
+    return Status(grpc::StatusCode::NOT_FOUND,
+                  "unknown computational id " + computational_id);
+  }
+
+  static std::vector<IGRFModel::Request> RequestsOf(
+      const SGPComputeResponse& SGPResponse) {
+    std::vector<IGRFModel::Request> requests;
+    requests.reserve(SGPResponse.geodetic_size());
     for (auto& coord : SGPResponse.geodetic()) {
-      uint64_t time = coord.encoded_time();
-      // std::cout << "acc " << time;
-      DateTime date(time);
-      int year = 0, month = 0, day = 0;
-      date.FromTicks(year, month, day);
-      std::string str_date;
-      str_date = std::to_string(year) + ","
-         + std::to_string(month) + ","
-         + std::to_string(day);
-
-      igrf_request IGRFrequest;
-      IGRFrequest.date = reinterpret_cast<char*>(malloc(str_date.length()+1));
-      snprintf(IGRFrequest.date, str_date.length()+1, "%s",  str_date.c_str());
+      IGRFModel::Request IGRFrequest;
+      IGRFrequest.sdate = DecimalYearOf(coord.encoded_time());
       IGRFrequest.coord_type = 'D';
       IGRFrequest.altitude_type = 'K';
       IGRFrequest.altitude = coord.alt();
       IGRFrequest.latitude = coord.lat();
       IGRFrequest.longitude = coord.lon();
-      igrf_computation IGRFcomputation;
-      igrf_compute(&IGRFrequest, &IGRFcomputation);
-      igrf_computation_result computation_result = IGRFcomputation.result;
-      igrf_computation_secular_variance variance = IGRFcomputation.variance;
-
-      if (TLErequest->add_noise_to_igrf()) {
-        GaussianNoise<PseudoNoiseMixin> noise(0, 50);
-        if (IGRFcomputation.result.has_x) {
-          computation_result.x += noise.Apply();
-        }
-        computation_result.y += noise.Apply();
-        computation_result.z += noise.Apply();
-        if (IGRFcomputation.result.has_declination) {
-          computation_result.declination += noise.Apply();
+      requests.push_back(IGRFrequest);
+    }
+    return requests;
+  }
+
+  static Status UnknownModel(const std::string& model_id) {
+    return Status(grpc::StatusCode::NOT_FOUND, "unknown model " + model_id);
+  }
+
+  ///////////////
+  Status endWork(const EndRequest* EndReq, CloseRequest* req) {
+    req->set_computational_id(EndReq->computational_id());
+    return Status::OK;
+  }
+
+  Status endWorkLocally(const EndRequest* EndReq, EndResponse*) {
+    if (!satellites_->Remove(EndReq->computational_id())) {
+      return UnknownSatellite(EndReq->computational_id());
+    }
+    ForgetTLE(EndReq->computational_id());
+    return Status::OK;
+  }
+
+  Status endedWork(const EndRequest* EndReq,
+                   const Status& status,
+                   const CloseResponse*,
+                   EndResponse*) {
+    if (status.ok()) ForgetTLE(EndReq->computational_id());
+    if (!status.ok())
+      std::cout << "IGRF" << status.error_code()
+          << " " << status.error_message();
+    return status;
+  }
+  ///////////////
+
+  // Whether the worker pool has workers; with --threads=0 it has none.
+  bool CanOffload() const { return pool_ != nullptr && pool_->size() > 0; }
+
+  // Runs `task` on the worker pool, or right away when the pool has no
+  // workers to ever run it. A call that offloads a task may be gone by the
+  // time the task returns.
+  void Offload(std::function<void()> task) {
+    if (!CanOffload()) {
+      task();
+      return;
+    }
+    offloaded_.fetch_add(1);
+    pool_->Submit([this, task = std::move(task)] {
+      task();
+      offloaded_.fetch_sub(1);
+    });
+  }
+
+  // Points per chunk handed to the worker pool; smaller requests are
+  // evaluated on the handler thread alone.
+  static constexpr size_t kParallelChunk = 4096;
+
+  // Satellites per chunk of a propagateConstellation call, parsed and
+  // propagated together by one worker.
+  static constexpr size_t kConstellationChunk = 512;
+
+  // Largest number of floats a computeGrid response may hold, 64 MiB.
+  static constexpr size_t kMaxGridValues = size_t(1) << 24;
+
+  // Largest number of samples a computeTLE response may hold, which keeps
+  // it well inside the 2 GiB protobuf allows a message in either encoding.
+  // computeTLEStream holds one chunk at a time and takes any number.
+  static constexpr size_t kMaxSamples = size_t(1) << 22;
+
+  // Most entries a RepeatedField holds, and so most points a PointResult
+  // can take.
+  static constexpr size_t kMaxPoints = std::numeric_limits<int>::max();
+  static_assert(kMaxSamples <= kMaxPoints && kMaxChunk <= kMaxPoints);
+
+  // Evaluates `requests` into `point_result`.
+  Status ComputePoints(const IGRFModel& model,
+                     const std::vector<IGRFModel::Request>& requests,
+                     bool add_noise, uint32_t max_degree, bool columnar,
+                     PointResult* point_result) const {
+    const int degree = std::min<uint32_t>(max_degree, IGRFModel::kMaxDegree);
+    return ComputeChunks(requests.size(), add_noise, columnar, point_result,
+                         [&](size_t begin, size_t end,
+                             igrf_computation* computations, double* bounds) {
+      model.ComputeBatch(requests.data() + begin, end - begin,
+                           computations, degree, bounds);
+    });
+  }
+
+  // ComputePoints, answering the points already in cache_ from there and
+  // adding the others. The cache holds results before noise is applied.
+  Status ComputeCachedPoints(const IGRFModel& model, uint64_t serial,
+                             const std::vector<IGRFModel::Request>& requests,
+                             bool add_noise, uint32_t max_degree,
+                             bool columnar, PointResult* point_result) const {
+    if (!cache_) {
+      return ComputePoints(model, requests, add_noise, max_degree, columnar,
+                           point_result);
+    }
+    const int degree = std::min<uint32_t>(max_degree, IGRFModel::kMaxDegree);
+    return ComputeChunks(requests.size(), add_noise, columnar, point_result,
+                         [&](size_t begin, size_t end,
+                             igrf_computation* computations, double* bounds) {
+      std::vector<ResultCache::Key> keys;
+      std::vector<IGRFModel::Request> missed;
+      std::vector<size_t> slots;
+      ResultCache::Value value;
+      for (size_t i = begin; i < end; ++i) {
+        ResultCache::Key key =
+            ResultCache::MakeKey(serial, degree, requests[i]);
+        if (cache_->Lookup(key, &value)) {
+          computations[i - begin] = value.computation;
+          bounds[i - begin] = value.truncation_bound;
+        } else {
+          keys.push_back(key);
+          missed.push_back(requests[i]);
+          slots.push_back(i - begin);
         }
-        // computation_result.sdate += noise.Apply();
-        computation_result.inclination += noise.Apply();
       }
+      if (missed.empty()) return;
+      std::vector<igrf_computation> computed(missed.size());
+      std::vector<double> computed_bounds(missed.size());
+      model.ComputeBatch(missed.data(), missed.size(), computed.data(),
+                         degree, computed_bounds.data());
+      for (size_t j = 0; j < missed.size(); ++j) {
+        computations[slots[j]] = computed[j];
+        bounds[slots[j]] = computed_bounds[j];
+        cache_->Insert(keys[j], {computed[j], computed_bounds[j]});
+      }
+    });
+  }
+
+  // Evaluates a registered site at `sdates` into `point_result`.
+  Status ComputeSite(const IGRFModel& model, const IGRFModel::Site& site,
+                     const std::vector<double>& sdates,
+                     bool add_noise, uint32_t max_degree, bool columnar,
+                     PointResult* point_result) const {
+    const int degree = std::min<uint32_t>(max_degree, IGRFModel::kMaxDegree);
+    return ComputeChunks(sdates.size(), add_noise, columnar, point_result,
+                         [&](size_t begin, size_t end,
+                             igrf_computation* computations, double* bounds) {
+      model.ComputeSite(site, sdates.data() + begin, end - begin,
+                        computations, degree, bounds);
+    });
+  }
+
+  // Fills `count` entries of `point_result` from compute(begin, end,
+  // computations, bounds). Large batches are split into chunks that run on
+  // the worker pool, each chunk writing into its own preallocated slots so
+  // the results keep the order of the requests.
+  template <class Compute>
+  Status ComputeChunks(size_t count, bool add_noise, bool columnar,
+                       PointResult* point_result,
+                       const Compute& compute) const {
+    Status status = ReservePoints(count, columnar, point_result);
+    if (!status.ok()) return status;
+    auto fill = [&](size_t begin, size_t end) {
+      FillPoints(begin, end, add_noise, point_result, compute);
+    };
+    static_assert(kParallelChunk % 8 == 0);
+    if (pool_ != nullptr && count > kParallelChunk) {
+      pool_->ParallelFor(count, kParallelChunk, fill);
+    } else {
+      fill(0, count);
+    }
+    return Status::OK;
+  }
+
+  // Sizes `point_result` for `count` points, as the result and variance
+  // messages or, when `columnar`, as the arrays of point_result.columns.
+  // Fails, leaving `point_result` alone, for more than kMaxPoints.
+  static Status ReservePoints(size_t count, bool columnar,
+                              PointResult* point_result) {
+    if (count > kMaxPoints) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                    std::to_string(count) + " points exceed the " +
+                        std::to_string(kMaxPoints) + " a result can hold");
+    }
+    const int size = static_cast<int>(count);
+    if (columnar) {
+      ResizeColumns(size, point_result->mutable_columns());
+    } else {
+      point_result->mutable_result()->Reserve(size);
+      point_result->mutable_variance()->Reserve(size);
+      for (int i = 0; i < size; ++i) {
+        point_result->add_result();
+        point_result->add_variance();
+      }
+    }
+    point_result->mutable_error_code()->Resize(size, 0);
+    point_result->mutable_truncation_error()->Resize(size, 0);
+    return Status::OK;
+  }
+
+  // Fills the entries [begin, end) of a `point_result` sized by
+  // ReservePoints from compute(begin, end, computations, bounds). Separate
+  // ranges may be filled concurrently when `begin` is a multiple of 8, so
+  // that no two of them share a byte of the validity bitmaps.
+  template <class Compute>
+  static void FillPoints(size_t begin, size_t end, bool add_noise,
+                         PointResult* point_result, const Compute& compute) {
+    PointColumns* columns = point_result->has_columns()
+        ? point_result->mutable_columns() : nullptr;
+    std::vector<igrf_computation> computations(end - begin);
+    compute(begin, end, computations.data(),
+            point_result->mutable_truncation_error()->mutable_data() + begin);
+    std::vector<double> deviates;
+    if (add_noise) {
+      GaussianNoise<PseudoNoiseMixin> noise(0, 50);
+      deviates.resize(kNoisePerPoint * (end - begin));
+      noise.Fill(deviates.data(), deviates.size());
+    }
+    for (size_t i = begin; i < end; ++i) {
+      igrf_computation& computation = computations[i - begin];
+      if (add_noise) {
+        ApplyNoise(&deviates[kNoisePerPoint * (i - begin)],
+                   &computation.result);
+      }
+      if (columns != nullptr) {
+        FillColumns(computation, i, columns);
+      } else {
+        FillPoint(computation, point_result->mutable_result(i),
+                  point_result->mutable_variance(i));
+      }
+      point_result->set_error_code(i, computation.error_code);
+    }
+  }
+
+  // Deviates for x, y, z, declination and inclination, in that order;
+  // those of components a result lacks go unused.
+  static constexpr size_t kNoisePerPoint = 5;
+
+  static void ApplyNoise(const double* deviates,
+                         igrf_computation_result* computation_result) {
+    if (computation_result->has_x) {
+      computation_result->x += deviates[0];
+    }
+    computation_result->y += deviates[1];
+    computation_result->z += deviates[2];
+    if (computation_result->has_declination) {
+      computation_result->declination += deviates[3];
+    }
+    computation_result->inclination += deviates[4];
+  }
+
+  static void ResizeColumns(int count, PointColumns* columns) {
+    for (auto* column : {columns->mutable_sdate(), columns->mutable_x(),
+                         columns->mutable_y(), columns->mutable_z(),
+                         columns->mutable_horizontal_intensity(),
+                         columns->mutable_total_intensity(),
+                         columns->mutable_declination(),
+                         columns->mutable_inclination(),
+                         columns->mutable_x_dot(), columns->mutable_y_dot(),
+                         columns->mutable_z_dot(),
+                         columns->mutable_horizontal_intensity_dot(),
+                         columns->mutable_total_intensity_dot(),
+                         columns->mutable_declination_dot(),
+                         columns->mutable_inclination_dot()}) {
+      column->Resize(count, 0.0);
+    }
+    const size_t bytes = (static_cast<size_t>(count) + 7) / 8;
+    columns->mutable_has_x()->assign(bytes, '\0');
+    columns->mutable_has_declination()->assign(bytes, '\0');
+  }
+
+  // Writes point `i` into `columns`, sized by ResizeColumns. Undefined
+  // components are left at 0, as they are in the message form.
+  static void FillColumns(const igrf_computation& IGRFcomputation, size_t i,
+                          PointColumns* columns) {
+    const igrf_computation_result& result = IGRFcomputation.result;
+    const igrf_computation_secular_variance& variance =
+        IGRFcomputation.variance;
+    columns->set_sdate(i, result.sdate);
+    columns->set_y(i, result.y);
+    columns->set_z(i, result.z);
+    columns->set_horizontal_intensity(i, result.horizontal_intensity);
+    columns->set_total_intensity(i, result.total_intensity);
+    columns->set_inclination(i, result.inclination);
+    columns->set_y_dot(i, variance.y_dot);
+    columns->set_z_dot(i, variance.z_dot);
+    columns->set_horizontal_intensity_dot(i,
+                                          variance.horizontal_intensity_dot);
+    columns->set_total_intensity_dot(i, variance.total_intensity_dot);
+    columns->set_inclination_dot(i, variance.inclination_dot);
+    const char bit = static_cast<char>(1 << (i % 8));
+    if (result.has_x) {
+      columns->set_x(i, result.x);
+      columns->set_x_dot(i, variance.x_dot);
+      (*columns->mutable_has_x())[i / 8] |= bit;
+    }
+    if (result.has_declination) {
+      columns->set_declination(i, result.declination);
+      columns->set_declination_dot(i, variance.declination_dot);
+      (*columns->mutable_has_declination())[i / 8] |= bit;
+    }
+  }
+
+  static void FillPoint(const igrf_computation& IGRFcomputation,
+                        IGRF::igrf_computation_result* tmp_result,
+                        IGRF::igrf_computation_secular_variance* tmp_variance) {
+    const igrf_computation_result& computation_result =
+        IGRFcomputation.result;
+    const igrf_computation_secular_variance& variance =
+        IGRFcomputation.variance;
+
+    tmp_result->set_sdate(computation_result.sdate);
+    if (IGRFcomputation.result.has_declination) {
+      tmp_result->set_declination(computation_result.declination);
+    }
+    tmp_result->set_inclination(computation_result.inclination);
+    if (IGRFcomputation.result.has_x) {
+      tmp_result->set_x(computation_result.x);
+    }
+    tmp_result->set_y(computation_result.y);
+    tmp_result->set_z(computation_result.z);
+
+    tmp_result->set_horizontal_intensity(
+        computation_result.horizontal_intensity);
+    tmp_result->set_total_intensity(computation_result.total_intensity);
+
+    if (IGRFcomputation.variance.has_declination) {
+      tmp_variance->set_declination_dot(variance.declination_dot);
+    }
+    tmp_variance->set_inclination_dot(variance.inclination_dot);
+    if (IGRFcomputation.variance.has_x) {
+      tmp_variance->set_x_dot(variance.x_dot);
+    }
+    tmp_variance->set_y_dot(variance.y_dot);
+    tmp_variance->set_z_dot(variance.z_dot);
+
+    tmp_variance->set_horizontal_intensity_dot(
+        variance.horizontal_intensity_dot);
+    tmp_variance->set_total_intensity_dot(variance.total_intensity_dot);
+  }
+
+  IGRFService::AsyncService service_;
+  std::unique_ptr<SGPService::Stub> stub_;
+  ModelRegistry* models_;
+  ThreadPool* pool_;
+  SatelliteRegistry* satellites_;
+  std::unique_ptr<ResultCache> cache_;
+  std::unique_ptr<EphemerisCache> ephemeris_;
+  // The ephemeris_ key, element lines and all, of every computational id
+  // constructed while ephemeris_ is on.
+  mutable std::mutex tles_mutex_;
+  std::unordered_map<std::string, EphemerisCache::Key> tles_;
+  // Work still running off the completion queue threads on behalf of a
+  // call: reloadModel, computeTLE chunks and locally propagated
+  // computeTLEStream chunks. Run waits for it before shutting the
+  // completion queues down.
+  std::atomic<int> offloaded_{0};
+  // Sites registered through registerSite. Lookups copy the pointer out, so
+  // a site released mid-computation stays alive until that call is done.
+  std::mutex sites_mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const IGRFModel::Site>>
+      sites_;
+  uint64_t last_site_ = 0;
+  std::unique_ptr<Server> server_;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+};
+
+// Calls build their messages on an arena of their own, released in one go
+// with the call. Blocks grow to 1 MiB, so a response of a million points
+// takes a few dozen allocations instead of one per sub-message.
+ArenaOptions CallArenaOptions() {
+  ArenaOptions options;
+  options.start_block_size = 4096;
+  options.max_block_size = 1 << 20;
+  return options;
+}
+
+// An RPC in flight. Every operation started on behalf of the call uses the
+// call itself as the completion queue tag.
+class IGRFServiceImpl::Call {
+ public:
+  virtual ~Call() = default;
+  virtual void Proceed(bool ok) = 0;
+};
 
-      auto point_result = TLEresponse->mutable_results();
+// An RPC answered from this process alone.
+template <class Request, class Response>
+class IGRFServiceImpl::UnaryCall : public IGRFServiceImpl::Call {
+ public:
+  using Requester = void (IGRFService::AsyncService::*)(
+      ServerContext*, Request*, grpc::ServerAsyncResponseWriter<Response>*,
+      grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+  using Handler = Status (IGRFServiceImpl::*)(const Request*, Response*);
+
+  UnaryCall(IGRFServiceImpl* service, grpc::ServerCompletionQueue* cq,
+            Requester requester, Handler handler)
+      : service_(service), cq_(cq), requester_(requester), handler_(handler),
+        arena_(CallArenaOptions()),
+        request_(Arena::CreateMessage<Request>(&arena_)),
+        response_(Arena::CreateMessage<Response>(&arena_)),
+        responder_(&context_) {
+    (service_->service_.*requester_)(&context_, request_, &responder_,
+                                     cq_, cq_, this);
+  }
 
-      auto tmp_result = point_result->add_result();  // tmp_result is a pointer
-      tmp_result->set_sdate(computation_result.sdate);
-      if (IGRFcomputation.result.has_declination) {
-        tmp_result->set_declination(computation_result.declination);
+  void Proceed(bool ok) override {
+    if (finishing_ || !ok) {
+      delete this;
+      return;
+    }
+    new UnaryCall(service_, cq_, requester_, handler_);
+    Status status = (service_->*handler_)(request_, response_);
+    finishing_ = true;
+    responder_.Finish(*response_, status, this);
+  }
+
+ private:
+  IGRFServiceImpl* service_;
+  grpc::ServerCompletionQueue* cq_;
+  Requester requester_;
+  Handler handler_;
+  ServerContext context_;
+  Arena arena_;
+  Request* request_;
+  Response* response_;
+  grpc::ServerAsyncResponseWriter<Response> responder_;
+  bool finishing_ = false;
+};
+
+// An RPC that is answered after a call to the SGP service. `prepare` turns
+// the request into the downstream one, and `complete` builds the response
+// once SGP has replied; the downstream call completes on the same queue.
+template <class Request, class Response, class SGPRequest, class SGPResponse>
+class IGRFServiceImpl::RelayCall : public IGRFServiceImpl::Call {
+ public:
+  using Requester = void (IGRFService::AsyncService::*)(
+      ServerContext*, Request*, grpc::ServerAsyncResponseWriter<Response>*,
+      grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+  using Downstream =
+      std::unique_ptr<grpc::ClientAsyncResponseReader<SGPResponse>>
+          (SGPService::Stub::*)(ClientContext*, const SGPRequest&,
+                                grpc::CompletionQueue*);
+  using Prepare = Status (IGRFServiceImpl::*)(const Request*, SGPRequest*);
+  using Complete = Status (IGRFServiceImpl::*)(
+      const Request*, const Status&, const SGPResponse*, Response*);
+
+  RelayCall(IGRFServiceImpl* service, grpc::ServerCompletionQueue* cq,
+            Requester requester, Downstream downstream,
+            Prepare prepare, Complete complete)
+      : service_(service), cq_(cq), requester_(requester),
+        downstream_(downstream), prepare_(prepare), complete_(complete),
+        arena_(CallArenaOptions()),
+        request_(Arena::CreateMessage<Request>(&arena_)),
+        response_(Arena::CreateMessage<Response>(&arena_)),
+        responder_(&context_),
+        sgp_request_(Arena::CreateMessage<SGPRequest>(&arena_)),
+        sgp_response_(Arena::CreateMessage<SGPResponse>(&arena_)) {
+    (service_->service_.*requester_)(&context_, request_, &responder_,
+                                     cq_, cq_, this);
+  }
+
+  void Proceed(bool ok) override {
+    switch (state_) {
+      case State::kRequested: {
+        if (!ok) break;
+        new RelayCall(service_, cq_, requester_, downstream_,
+                      prepare_, complete_);
+        Status status = (service_->*prepare_)(request_, sgp_request_);
+        if (!status.ok()) {
+          state_ = State::kFinishing;
+          responder_.FinishWithError(status, this);
+          return;
+        }
+        state_ = State::kRelaying;
+        reader_ = (service_->stub_.get()->*downstream_)(
+            &client_context_, *sgp_request_, cq_);
+        reader_->Finish(sgp_response_, &sgp_status_, this);
+        return;
+      }
+      case State::kRelaying: {
+        Status status = (service_->*complete_)(request_, sgp_status_,
+                                               sgp_response_, response_);
+        state_ = State::kFinishing;
+        responder_.Finish(*response_, status, this);
+        return;
       }
-      tmp_result->set_inclination(computation_result.inclination);
-      if (IGRFcomputation.result.has_x) {
-        tmp_result->set_x(computation_result.x);
+      case State::kFinishing:
+        break;
+    }
+    delete this;
+  }
+
+ private:
+  enum class State { kRequested, kRelaying, kFinishing };
+
+  IGRFServiceImpl* service_;
+  grpc::ServerCompletionQueue* cq_;
+  Requester requester_;
+  Downstream downstream_;
+  Prepare prepare_;
+  Complete complete_;
+  ServerContext context_;
+  Arena arena_;
+  Request* request_;
+  Response* response_;
+  grpc::ServerAsyncResponseWriter<Response> responder_;
+  ClientContext client_context_;
+  SGPRequest* sgp_request_;
+  SGPResponse* sgp_response_;
+  Status sgp_status_;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<SGPResponse>> reader_;
+  State state_ = State::kRequested;
+};
+
+// computeTLE: the samples are fetched from SGP in chunks, up to
+// kPipelineDepth of them at once, and every chunk is evaluated on the
+// worker pool as soon as it arrives, so that the SGP and IGRF stages
+// overlap. A chunk is counted until its evaluation is done, which bounds
+// the samples held at once whichever stage is the slower one. The call
+// keeps the model it started with until it finishes.
+class IGRFServiceImpl::TLEComputeCall : public IGRFServiceImpl::Call {
+ public:
+  TLEComputeCall(IGRFServiceImpl* service, grpc::ServerCompletionQueue* cq)
+      : service_(service), cq_(cq), arena_(CallArenaOptions()),
+        request_(Arena::CreateMessage<TLEComputeRequest>(&arena_)),
+        response_(Arena::CreateMessage<TLEComputeResponse>(&arena_)),
+        responder_(&context_) {
+    service_->service_.RequestcomputeTLE(&context_, request_, &responder_,
+                                         cq_, cq_, this);
+  }
+
+  void Proceed(bool ok) override {
+    if (finishing_ || !ok) {
+      delete this;
+      return;
+    }
+    new TLEComputeCall(service_, cq_);
+    Status status = CheckSamples(*request_, kMaxSamples);
+    if (status.ok()) {
+      model_ = service_->models_->Acquire(request_->model_id());
+      if (model_ == nullptr) status = UnknownModel(request_->model_id());
+    }
+    if (!status.ok()) {
+      finishing_ = true;
+      responder_.FinishWithError(status, this);
+      return;
+    }
+    count_ = SampleCount(*request_);
+    // Chunks are filled concurrently, so each starts on a bitmap byte.
+    chunk_ = (ChunkSize(*request_) + 7) / 8 * 8;
+    status = ReservePoints(count_, request_->columnar(),
+                           response_->mutable_results());
+    if (!status.ok()) {
+      finishing_ = true;
+      responder_.FinishWithError(status, this);
+      return;
+    }
+    Settle(std::unique_lock<std::mutex>(mutex_));
+  }
+
+ private:
+  // The SGPCompute call for the samples [begin, end), on an arena of its
+  // own that goes away once the samples are evaluated.
+  struct Fetch : public Call {
+    explicit Fetch(TLEComputeCall* call)
+        : call(call),
+          request(Arena::CreateMessage<SGPComputeRequest>(&arena)),
+          response(Arena::CreateMessage<SGPComputeResponse>(&arena)) {}
+
+    void Proceed(bool) override { call->Fetched(this); }
+
+    TLEComputeCall* call;
+    size_t begin = 0;
+    size_t end = 0;
+    bool propagate = false;  // in process, rather than by SGP
+    ClientContext context;
+    Arena arena;
+    SGPComputeRequest* request;
+    SGPComputeResponse* response;
+    CachedSamples cached;
+    Status status;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<SGPComputeResponse>>
+        reader;
+  };
+
+  // On the completion queue thread.
+  void Fetched(Fetch* fetch) {
+    service_->Offload([this, fetch] { Settle(Run(fetch)); });
+  }
+
+  // Propagates `fetch` if it is to be propagated in process, then checks
+  // and evaluates it. Returns with mutex_ held and the fetch gone and no
+  // longer counted, so that the caller settles the call before anyone else
+  // can finish it.
+  std::unique_lock<std::mutex> Run(Fetch* fetch) {
+    if (fetch->propagate) {
+      fetch->status =
+          service_->PropagateLocally(*fetch->request,
+                                     request_->interpolation_tolerance(),
+                                     fetch->response);
+    }
+    if (Check(fetch)) Evaluate(fetch);
+    std::unique_lock<std::mutex> lock(mutex_);
+    --in_flight_;
+    return lock;
+  }
+
+  // Whether `fetch` holds its samples, cached ones included; if not, the
+  // call fails with its status and the fetch is gone.
+  bool Check(Fetch* fetch) {
+    if (fetch->status.ok()) {
+      service_->MergeEphemeris(&fetch->cached, fetch->response);
+    }
+    if (fetch->status.ok() &&
+        fetch->response->geodetic_size() != int(fetch->end - fetch->begin)) {
+      fetch->status = Status(grpc::StatusCode::INTERNAL,
+                             "SGP returned " +
+                                 std::to_string(
+                                     fetch->response->geodetic_size()) +
+                                 " samples for " +
+                                 std::to_string(fetch->end - fetch->begin));
+    }
+    if (!fetch->status.ok()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (status_.ok()) status_ = fetch->status;
       }
-      tmp_result->set_y(computation_result.y);
-      tmp_result->set_z(computation_result.z);
+      delete fetch;
+      return false;
+    }
+    return true;
+  }
 
-      tmp_result->set_horizontal_intensity(
-          computation_result.horizontal_intensity);
-      tmp_result->set_total_intensity(computation_result.total_intensity);
+  void Evaluate(Fetch* fetch) {
+    const std::vector<IGRFModel::Request> requests =
+        RequestsOf(*fetch->response);
+    const int degree =
+        std::min<uint32_t>(request_->max_degree(), IGRFModel::kMaxDegree);
+    FillPoints(fetch->begin, fetch->end, request_->add_noise_to_igrf(),
+               response_->mutable_results(),
+               [&](size_t begin, size_t end,
+                   igrf_computation* computations, double* bounds) {
+      model_->ComputeBatch(requests.data(), end - begin, computations,
+                           degree, bounds);
+    });
+    delete fetch;
+  }
 
-      auto tmp_variance = point_result->add_variance();
-      if (IGRFcomputation.variance.has_declination) {
-        tmp_variance->set_declination_dot(variance.declination_dot);
+  // Starts the fetches the window has room for, and finishes the call once
+  // nothing is left in flight. Called with mutex_ held in `lock`; the call
+  // may be gone when it returns. Fetches that no worker can take are run
+  // here, and the window refilled after them, in a loop rather than by
+  // recursion, however many chunks a pool without workers goes through.
+  void Settle(std::unique_lock<std::mutex> lock) {
+    for (;;) {
+      std::vector<Fetch*> started;
+      while (status_.ok() && next_ < count_ && in_flight_ < kPipelineDepth) {
+        Fetch* fetch = new Fetch(this);
+        fetch->begin = next_;
+        fetch->end = std::min(count_, next_ + chunk_);
+        next_ = fetch->end;
+        ++in_flight_;
+        started.push_back(fetch);
+      }
+      const bool done =
+          in_flight_ == 0 && !(status_.ok() && next_ < count_);
+      finishing_ = done;
+      const Status status = status_;
+      lock.unlock();
+      // The fetches just counted keep the call alive.
+      std::vector<Fetch*> here;
+      for (Fetch* fetch : started) {
+        if (!Start(fetch)) here.push_back(fetch);
+      }
+      if (here.empty()) {
+        if (!done) return;
+        if (status.ok()) {
+          responder_.Finish(*response_, status, this);
+        } else {
+          responder_.FinishWithError(status, this);
+        }
+        return;
       }
-      tmp_variance->set_inclination_dot(variance.inclination_dot);
-      if (IGRFcomputation.variance.has_x) {
-        tmp_variance->set_x_dot(variance.x_dot);
+      for (size_t i = 0; i < here.size(); ++i) {
+        // The fetches after this one still keep the call alive.
+        if (lock.owns_lock()) lock.unlock();
+        lock = Run(here[i]);
       }
-      tmp_variance->set_y_dot(variance.y_dot);
-      tmp_variance->set_z_dot(variance.z_dot);
+    }
+  }
 
-      tmp_variance->set_horizontal_intensity_dot(
-          variance.horizontal_intensity_dot);
-      tmp_variance->set_total_intensity_dot(variance.total_intensity_dot);
+  // Sends `fetch` on its way: to SGP, or to a worker when it is to be
+  // propagated in process or is all in ephemeris_. Returns false, leaving
+  // the fetch to the caller to Run, when there is no worker to take it.
+  bool Start(Fetch* fetch) {
+    PrepareSGPRequest(*request_, fetch->begin, fetch->end, fetch->request);
+    const bool fetching = service_->LookupEphemeris(
+        *request_, fetch->begin, fetch->end, fetch->request, &fetch->cached);
+    if (!fetching || service_->satellites_ != nullptr) {
+      fetch->propagate = fetching;
+      if (!service_->CanOffload()) return false;
+      service_->Offload([this, fetch] { Settle(Run(fetch)); });
+      return true;
+    }
+    fetch->reader = service_->stub_->AsyncSGPCompute(
+        &fetch->context, *fetch->request, cq_);
+    fetch->reader->Finish(fetch->response, &fetch->status, fetch);
+    return true;
+  }
 
+  IGRFServiceImpl* service_;
+  grpc::ServerCompletionQueue* cq_;
+  ServerContext context_;
+  Arena arena_;
+  TLEComputeRequest* request_;
+  TLEComputeResponse* response_;
+  grpc::ServerAsyncResponseWriter<TLEComputeResponse> responder_;
+  // Acquired rather than read, so that a reload need not wait for the call.
+  std::shared_ptr<const IGRFModel> model_;
+  size_t count_ = 0;
+  size_t chunk_ = kStreamChunk;
+  std::mutex mutex_;
+  // Guarded by mutex_.
+  size_t next_ = 0;
+  size_t in_flight_ = 0;
+  Status status_;
+  bool finishing_ = false;
+};
 
-      point_result->add_error_code(IGRFcomputation.error_code);
+// computeTLEStream: the samples are fetched from SGP one chunk at a time,
+// and each chunk is evaluated and written out before the next one is
+// requested, so at most one chunk is held in memory whatever the length of
+// the window. Like computeTLE, the call keeps the model it started with
+// until it finishes.
+class IGRFServiceImpl::TLEStreamCall : public IGRFServiceImpl::Call {
+ public:
+  TLEStreamCall(IGRFServiceImpl* service, grpc::ServerCompletionQueue* cq)
+      : service_(service), cq_(cq), arena_(CallArenaOptions()),
+        request_(Arena::CreateMessage<TLEComputeRequest>(&arena_)),
+        response_(Arena::CreateMessage<TLEComputeResponse>(&arena_)),
+        writer_(&context_),
+        sgp_request_(Arena::CreateMessage<SGPComputeRequest>(&arena_)),
+        sgp_response_(Arena::CreateMessage<SGPComputeResponse>(&arena_)) {
+    service_->service_.RequestcomputeTLEStream(&context_, request_, &writer_,
+                                               cq_, cq_, this);
+  }
+
+  void Proceed(bool ok) override {
+    switch (state_) {
+      case State::kRequested:
+        if (!ok) break;
+        new TLEStreamCall(service_, cq_);
+        chunk_ = ChunkSize(*request_);
+        count_ = SampleCount(*request_);
+        if (Status status = CheckSamples(
+                *request_, std::numeric_limits<uint64_t>::max());
+            !status.ok()) {
+          Finish(status);
+          return;
+        }
+        // Before SGP is asked for anything.
+        model_ = service_->models_->Acquire(request_->model_id());
+        if (model_ == nullptr) {
+          Finish(UnknownModel(request_->model_id()));
+          return;
+        }
+        FetchNext();
+        return;
+      case State::kFetching:
+        if (!ok) break;  // the server is shutting down
+        // A failed SGP call fails the stream with its status.
+        if (!sgp_status_.ok()) {
+          Finish(sgp_status_);
+          return;
+        }
+        service_->MergeEphemeris(&cached_, sgp_response_);
+        // Cleared messages keep their storage on the arena, so every chunk
+        // reuses what the first one allocated.
+        response_->Clear();
+        if (Status status = service_->computedTLE(*model_, request_,
+                                                  sgp_response_, response_);
+            !status.ok()) {
+          Finish(status);
+          return;
+        }
+        state_ = State::kWriting;
+        writer_.Write(*response_, this);
+        return;
+      case State::kWriting:
+        if (!ok) break;  // the client has gone away
+        FetchNext();
+        return;
+      case State::kFinishing:
+        break;
     }
+    delete this;
+  }
 
-    // response->set_coord_type(TLErequest->coord_type());
-    // TLEresponse->set_status(SGP::Status::OK);
-    // response->set_number_of_sets(request->number_of_sets());
-    return Status::OK;
+ private:
+  enum class State { kRequested, kFetching, kWriting, kFinishing };
+
+  void FetchNext() {
+    if (next_ >= count_) {
+      Finish(Status::OK);
+      return;
+    }
+    const size_t end = std::min(count_, next_ + chunk_);
+    sgp_request_->Clear();
+    sgp_response_->Clear();
+    PrepareSGPRequest(*request_, next_, end, sgp_request_);
+    const bool fetching = service_->LookupEphemeris(*request_, next_, end,
+                                                    sgp_request_, &cached_);
+    next_ = end;
+    if (!fetching) {
+      sgp_status_ = Status::OK;
+      state_ = State::kFetching;
+      Proceed(true);
+      return;
+    }
+    if (service_->satellites_ != nullptr) {
+      // Propagated on the worker pool, as computeTLE does, and then back on
+      // the completion queue through alarm_ for the IGRF stage, whose
+      // ParallelFor must not run on a worker.
+      state_ = State::kFetching;
+      service_->Offload([this] {
+        sgp_status_ = service_->PropagateLocally(
+            *sgp_request_, request_->interpolation_tolerance(),
+            sgp_response_);
+        alarm_.Set(cq_, gpr_now(GPR_CLOCK_MONOTONIC), this);
+      });
+      return;
+    }
+    client_context_.reset(new ClientContext);
+    state_ = State::kFetching;
+    reader_ = service_->stub_->AsyncSGPCompute(client_context_.get(),
+                                               *sgp_request_, cq_);
+    reader_->Finish(sgp_response_, &sgp_status_, this);
   }
 
-  ///////////////
-  Status endWork(ServerContext* context_,
-          const EndRequest* EndReq,
-          EndResponse* EndRes) {
-    auto id = EndReq->computational_id();
-    CloseRequest req;
-    req.set_computational_id(id);
-    ClientContext context;
-    CloseResponse res;
-    Status status = stub_->Close(&context, req, &res);
-    if (!status.ok())
-      std::cout << "IGRF" << status.error_code()
-          << " " << status.error_message();
-    return status;
+  void Finish(const Status& status) {
+    state_ = State::kFinishing;
+    writer_.Finish(status, this);
+  }
+
+  IGRFServiceImpl* service_;
+  grpc::ServerCompletionQueue* cq_;
+  ServerContext context_;
+  Arena arena_;
+  TLEComputeRequest* request_;
+  TLEComputeResponse* response_;
+  grpc::ServerAsyncWriter<TLEComputeResponse> writer_;
+  std::unique_ptr<ClientContext> client_context_;
+  SGPComputeRequest* sgp_request_;
+  SGPComputeResponse* sgp_response_;
+  std::shared_ptr<const IGRFModel> model_;
+  CachedSamples cached_;
+  Status sgp_status_;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<SGPComputeResponse>> reader_;
+  grpc::Alarm alarm_;
+  size_t chunk_ = kStreamChunk;
+  size_t count_ = 0;
+  size_t next_ = 0;
+  State state_ = State::kRequested;
+};
+
+// reloadModel: loading the model and waiting for the calls still using the
+// old one happen on a thread started for the purpose, which then finishes
+// the RPC, so no completion queue thread is held meanwhile. The worker pool
+// is no place for the wait: a call holding the old model may itself be
+// waiting on pool tasks.
+class IGRFServiceImpl::ReloadCall : public IGRFServiceImpl::Call {
+ public:
+  ReloadCall(IGRFServiceImpl* service, grpc::ServerCompletionQueue* cq)
+      : service_(service), cq_(cq), responder_(&context_) {
+    service_->service_.RequestreloadModel(&context_, &request_, &responder_,
+                                          cq_, cq_, this);
+  }
+
+  void Proceed(bool ok) override {
+    if (finishing_ || !ok) {
+      delete this;
+      return;
+    }
+    new ReloadCall(service_, cq_);
+    finishing_ = true;
+    IGRFServiceImpl* service = service_;
+    service->offloaded_.fetch_add(1);
+    std::thread([this, service] {
+      Status status = service->reloadModel(&request_, &response_);
+      // Once finished the call may be deleted by a poller at any moment.
+      responder_.Finish(response_, status, this);
+      service->offloaded_.fetch_sub(1);
+    }).detach();
   }
-  ///////////////
 
  private:
-  std::unique_ptr<SGPService::Stub> stub_;
+  IGRFServiceImpl* service_;
+  grpc::ServerCompletionQueue* cq_;
+  ServerContext context_;
+  ModelReloadRequest request_;
+  ModelReloadResponse response_;
+  grpc::ServerAsyncResponseWriter<ModelReloadResponse> responder_;
+  bool finishing_ = false;
 };
 
-void RunServer(std::string port, bool test = false) {
-  std::string server_address("0.0.0.0:"+port);
-  IGRFServiceImpl service{grpc::CreateChannel("0.0.0.0:9090",
-                          grpc::InsecureChannelCredentials())};
+void IGRFServiceImpl::StartCalls(grpc::ServerCompletionQueue* cq) {
+  using AsyncService = IGRFService::AsyncService;
+  if (satellites_ != nullptr) {
+    new UnaryCall<SGPConstructRequest, SGPConstructResponse>(
+        this, cq, &AsyncService::Requestconstruct,
+        &IGRFServiceImpl::constructLocally);
+    new UnaryCall<EndRequest, EndResponse>(
+        this, cq, &AsyncService::RequestendWork,
+        &IGRFServiceImpl::endWorkLocally);
+  } else {
+    new RelayCall<SGPConstructRequest, SGPConstructResponse,
+                  SGPConstructRequest, SGPConstructResponse>(
+        this, cq, &AsyncService::Requestconstruct,
+        &SGPService::Stub::AsyncSGPConstruct,
+        &IGRFServiceImpl::construct, &IGRFServiceImpl::constructed);
+    new RelayCall<EndRequest, EndResponse, CloseRequest, CloseResponse>(
+        this, cq, &AsyncService::RequestendWork,
+        &SGPService::Stub::AsyncClose,
+        &IGRFServiceImpl::endWork, &IGRFServiceImpl::endedWork);
+  }
+  new UnaryCall<Point, PointResult>(
+      this, cq, &AsyncService::RequestcomputeForPoint,
+      &IGRFServiceImpl::computeForPoint);
+  new TLEComputeCall(this, cq);
+  new TLEStreamCall(this, cq);
+  new UnaryCall<SiteRequest, SiteResponse>(
+      this, cq, &AsyncService::RequestregisterSite,
+      &IGRFServiceImpl::registerSite);
+  new UnaryCall<SiteReleaseRequest, EndResponse>(
+      this, cq, &AsyncService::RequestreleaseSite,
+      &IGRFServiceImpl::releaseSite);
+  new ReloadCall(this, cq);
+  new UnaryCall<GridRequest, GridResult>(
+      this, cq, &AsyncService::RequestcomputeGrid,
+      &IGRFServiceImpl::computeGrid);
+  new UnaryCall<CacheStatsRequest, CacheStatsResponse>(
+      this, cq, &AsyncService::RequestcacheStats,
+      &IGRFServiceImpl::cacheStats);
+  new UnaryCall<ConstellationRequest, ConstellationResult>(
+      this, cq, &AsyncService::RequestpropagateConstellation,
+      &IGRFServiceImpl::propagateConstellation);
+}
+
+void IGRFServiceImpl::Poll(grpc::ServerCompletionQueue* cq) {
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    static_cast<Call*>(tag)->Proceed(ok);
+  }
+}
 
+void IGRFServiceImpl::Run(const std::string& server_address,
+                          size_t pollers, bool test) {
   ServerBuilder builder;
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
-  builder.RegisterService(&service);
-  std::unique_ptr<Server> server(builder.BuildAndStart());
+  builder.RegisterService(&service_);
+  pollers = std::max<size_t>(pollers, 1);
+  for (size_t i = 0; i < pollers; ++i) {
+    cqs_.push_back(builder.AddCompletionQueue());
+  }
+  server_ = builder.BuildAndStart();
   std::cout << "Server listening on " << server_address << std::endl;
+
+  std::vector<std::thread> threads;
+  for (auto& cq : cqs_) {
+    StartCalls(cq.get());
+    threads.emplace_back(&IGRFServiceImpl::Poll, this, cq.get());
+  }
   if (test) {
     bool keep_going = true;
     std::string s;
@@ -304,10 +1689,28 @@ void RunServer(std::string port, bool test = false) {
       if (s == "STOP") keep_going = false;
       pthread_yield();
     }
-    server->Shutdown();
+    server_->Shutdown();
   } else {
-    server->Wait();
+    server_->Wait();
   }
+  while (offloaded_.load() != 0) std::this_thread::yield();
+  for (auto& cq : cqs_) cq->Shutdown();
+  for (auto& thread : threads) thread.join();
+}
+
+// `sgp` is the address of the SGP service, or "local" to propagate in
+// process.
+void RunServer(std::string port, ModelRegistry* models, ThreadPool* pool,
+               size_t pollers, size_t cache_size, size_t ephemeris_budget,
+               const std::string& sgp, bool test = false) {
+  std::string server_address("0.0.0.0:"+port);
+  SatelliteRegistry satellites;
+  const bool local = sgp == "local";
+  IGRFServiceImpl service{grpc::CreateChannel(local ? "0.0.0.0:9090" : sgp,
+                          grpc::InsecureChannelCredentials()),
+                          models, pool, cache_size, ephemeris_budget,
+                          local ? &satellites : nullptr};
+  service.Run(server_address, pollers, test);
 }
 
 int main(int argc, char** argv) {
@@ -315,13 +1718,72 @@ int main(int argc, char** argv) {
   // std::string db = routeguide::GetDbFileContent(argc, argv);
   if (argc < 2) {
     std::cout << "Usage: ./sgp_server N [OPTIONS]\n N - port number\n"
-              << "OPTIONS include --test, which implies using a pipe";
+              << "OPTIONS include --test, which implies using a pipe,\n"
+              << "--threads=K, the size of the worker pool used for "
+              << "large requests (defaults to the number of cores),\n"
+              << "--pollers=K, the number of threads serving the "
+              << "completion queues (defaults to the number of cores),\n"
+              << "--cache=N, the number of computeForPoint results kept "
+              << "for repeated points (defaults to 65536, 0 disables it),\n"
+              << "--ephemeris_cache=MB, the memory kept for propagated "
+              << "computeTLE samples (defaults to 64, 0 disables it),\n"
+              << "--sgp=HOST:PORT, the SGP service (defaults to "
+              << "0.0.0.0:9090), or --sgp=local to propagate TLEs in "
+              << "process instead,\n"
+              << "and --model=ID:PATH, repeatable, which loads a further "
+              << "model (.COF or compiled image) under ID.\n"
+              << "The default model, IGRF13, is read from ./IGRF13.img or "
+              << "./IGRF13.COF";
     return 1;
   }
-  igrf_construct("./IGRF13.COF");
-  RunServer(argv[1], argc == 3 && strcmp(argv[2], "--test") == 0
-                      ? true
-                      : false);
+  bool test = false;
+  size_t threads = std::thread::hardware_concurrency();
+  size_t pollers = std::thread::hardware_concurrency();
+  size_t cache_size = 1 << 16;
+  size_t ephemeris_megabytes = 64;
+  std::string sgp = "0.0.0.0:9090";
+  std::vector<std::pair<std::string, std::string>> extra_models;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--test") == 0) {
+      test = true;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = std::strtoul(argv[i] + 10, nullptr, 10);
+    } else if (strncmp(argv[i], "--pollers=", 10) == 0) {
+      pollers = std::strtoul(argv[i] + 10, nullptr, 10);
+    } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+      cache_size = std::strtoul(argv[i] + 8, nullptr, 10);
+    } else if (strncmp(argv[i], "--ephemeris_cache=", 18) == 0) {
+      ephemeris_megabytes = std::strtoul(argv[i] + 18, nullptr, 10);
+    } else if (strncmp(argv[i], "--sgp=", 6) == 0) {
+      sgp = argv[i] + 6;
+    } else if (strncmp(argv[i], "--model=", 8) == 0) {
+      const char* spec = argv[i] + 8;
+      const char* colon = strchr(spec, ':');
+      if (colon == nullptr || colon == spec) {
+        std::cout << "Expected --model=ID:PATH, got " << argv[i] << std::endl;
+        return 1;
+      }
+      extra_models.emplace_back(std::string(spec, colon), colon + 1);
+    }
+  }
+  ModelRegistry models("IGRF13");
+  auto model = std::make_unique<IGRFModel>();
+  if (!model->LoadImage("./IGRF13.img") && !model->Load("./IGRF13.COF")) {
+    std::cout << "Failed to load ./IGRF13.img or ./IGRF13.COF" << std::endl;
+    return 1;
+  }
+  models.Publish(models.default_id(), std::move(model));
+  for (const auto& [id, path] : extra_models) {
+    model = std::make_unique<IGRFModel>();
+    if (!model->LoadImage(path) && !model->Load(path)) {
+      std::cout << "Failed to load " << path << std::endl;
+      return 1;
+    }
+    models.Publish(id, std::move(model));
+  }
+  ThreadPool pool(threads);
+  RunServer(argv[1], &models, &pool, pollers, cache_size,
+            ephemeris_megabytes << 20, sgp, test);
 
   return 0;
 }
@@ -0,0 +1,173 @@
+/**
+ * @file lane_math.h
+ * @brief Elementary functions for the GCC vector kernels of igrf_server
+ *
+ * V is a GCC vector of W doubles and M the matching comparison mask, as in
+ * igrf_model_simd.cpp. Every helper is always inlined, so that it is
+ * compiled for the target of the kernel that calls it, and passes vectors
+ * by reference: by value, their ABI would depend on that target.
+ *
+ * SinCos, Atan and Log reduce the argument and then use the Cephes
+ * minimax polynomials, which keeps them within a few units in the last
+ * place of the libm results over the ranges the kernels see.
+ */
+#pragma once
+
+#include <cmath>
+
+namespace lane {
+
+// Adding and subtracting 1.5 * 2^52 rounds a double below 2^51 in magnitude
+// to the nearest integer, which lands in the low bits of the sum.
+constexpr double kRoundMagic = 6755399441055744.0;
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr double kTwoOverPi = 0.63661977236758134308;
+
+// pi / 2 in three parts; the first two have short enough mantissas that
+// their products with a quadrant count are exact.
+constexpr double kPio2A = 1.57079625129699707031e+00;
+constexpr double kPio2B = 7.54978941586159635335e-08;
+constexpr double kPio2C = 5.39030285815811905290e-15;
+
+template <typename V, int W>
+__attribute__((always_inline)) inline void Sqrt(const V& x, V* root) {
+  for (int i = 0; i < W; ++i) (*root)[i] = std::sqrt(x[i]);
+}
+
+// Cube root of every positive lane: a third of the exponent, off by a few
+// percent, then three Halley steps, each of which cubes the relative error.
+template <typename V, typename M>
+__attribute__((always_inline)) inline void Cbrt(const V& x, V* root) {
+  V t = (V)((M)x / 3 + 0x2a9f7893782da1ce);
+  for (int step = 0; step < 3; ++step) {
+    const V t3 = t * t * t;
+    t = t * (t3 + 2.0 * x) / (2.0 * t3 + x);
+  }
+  *root = t;
+}
+
+template <typename V>
+__attribute__((always_inline)) inline void Floor(const V& x, V* floor_x) {
+  const V r = (x + kRoundMagic) - kRoundMagic;
+  *floor_x = r > x ? r - 1.0 : r;
+}
+
+template <typename M, int W>
+__attribute__((always_inline)) inline bool Any(const M& mask) {
+  for (int i = 0; i < W; ++i) {
+    if (mask[i]) return true;
+  }
+  return false;
+}
+
+template <typename M, int W>
+__attribute__((always_inline)) inline bool All(const M& mask) {
+  for (int i = 0; i < W; ++i) {
+    if (!mask[i]) return false;
+  }
+  return true;
+}
+
+// sin and cos of every lane: reduced to [-pi/4, pi/4] by the nearest
+// multiple of pi/2.
+template <typename V, typename M>
+__attribute__((always_inline)) inline void SinCos(const V& x, V* sin_x,
+                                                   V* cos_x) {
+  const V shifted = x * kTwoOverPi + kRoundMagic;
+  const V q = shifted - kRoundMagic;
+  const M quadrant = (M)shifted & 3;
+  V r = x - q * kPio2A;
+  r = r - q * kPio2B;
+  r = r - q * kPio2C;
+  const V z = r * r;
+  const V s = r + r * z *
+                      (((((1.58962301576546568060e-10 * z -
+                           2.50507477628578072866e-8) * z +
+                          2.75573136213857245213e-6) * z -
+                         1.98412698295895385996e-4) * z +
+                        8.33333333332211858878e-3) * z -
+                       1.66666666666666307295e-1);
+  const V c = 1.0 - 0.5 * z +
+              z * z *
+                  (((((-1.13585365213876817300e-11 * z +
+                       2.08757008419747316778e-9) * z -
+                      2.75573141792967388112e-7) * z +
+                     2.48015872888517045348e-5) * z -
+                    1.38888888888730564116e-3) * z +
+                   4.16666666666665929218e-2);
+  const M swap = (quadrant & 1) != 0;
+  const V sin_r = swap ? c : s;
+  const V cos_r = swap ? s : c;
+  *sin_x = (quadrant & 2) != 0 ? -sin_r : sin_r;
+  *cos_x = ((quadrant + 1) & 2) != 0 ? -cos_r : cos_r;
+}
+
+// atan of every lane: |x| is brought below tan(pi/8) through
+// atan(x) = pi/2 - atan(1/x) or pi/4 + atan((x - 1) / (x + 1)).
+template <typename V, typename M>
+__attribute__((always_inline)) inline void Atan(const V& x, V* atan_x) {
+  const V zero = {};
+  const V ax = x < 0.0 ? -x : x;
+  const M large = ax > 2.41421356237309504880;  // tan(3 pi / 8)
+  const M middle = (ax > 0.66) & ~large;
+  const V t = large ? -1.0 / ax : middle ? (ax - 1.0) / (ax + 1.0) : ax;
+  const V base = large ? zero + kPi / 2 : middle ? zero + kPi / 4 : zero;
+  // The low part of pi / 4 (or of pi / 2, twice it) lost above.
+  const V low = large ? zero + 6.123233995736765886130e-17
+                      : middle ? zero + 3.061616997868382943065e-17 : zero;
+  const V z = t * t;
+  const V p = (((-8.750608600031904122785e-1 * z -
+                 1.615753718733365076637e1) * z -
+                7.500855792314704667340e1) * z -
+               1.228866684490136173410e2) * z -
+              6.485021904942025371773e1;
+  const V q = ((((z + 2.485846490142306297962e1) * z +
+                 1.650270098316988542046e2) * z +
+                4.328810604912902668951e2) * z +
+               4.853903996359136964868e2) * z +
+              1.945506571482613964425e2;
+  const V a = base + (t * (z * p / q) + t + low);
+  *atan_x = x < 0.0 ? -a : a;
+}
+
+// log of every positive normal lane: x = 2^e m with m in [sqrt(1/2),
+// sqrt(2)), then log(m) = f - f^2 / 2 + f^3 P(f) / Q(f) with f = m - 1, and
+// e log(2) added in two parts.
+template <typename V, typename M>
+__attribute__((always_inline)) inline void Log(const V& x, V* log_x) {
+  const M bits = (M)x;
+  const V half_m = (V)((bits & 0x000fffffffffffffLL) | 0x3fe0000000000000LL);
+  const M small = half_m < 0.70710678118654752440;
+  // Comparisons give -1 in true lanes.
+  const M e = ((bits >> 52) & 0x7ff) - 1022 + small;
+  // Exact for any exponent: its low bits land in those of kRoundMagic.
+  const V fe = (V)(e + (M)(V{} + kRoundMagic)) - kRoundMagic;
+  const V f = small ? half_m + half_m - 1.0 : half_m - 1.0;
+  const V z = f * f;
+  const V p = ((((1.01875663804580931796e-4 * f +
+                  4.97494994976747001425e-1) * f +
+                 4.70579119878881725854e0) * f +
+                1.44989225341610930846e1) * f +
+               1.79368678507819816313e1) * f +
+              7.70838733755885391666e0;
+  const V q = ((((f + 1.12873587189167450590e1) * f +
+                 4.52279145837532221105e1) * f +
+                8.29875266912776603211e1) * f +
+               7.11544750618563894466e1) * f +
+              2.31251620126765340583e1;
+  const V y = f * (z * p / q) - fe * 2.121944400546905827679e-4 - 0.5 * z;
+  *log_x = f + y + fe * 0.693359375;
+}
+
+// atan2(y, x) of every lane, in [-pi, pi].
+template <typename V, typename M>
+__attribute__((always_inline)) inline void Atan2(const V& y, const V& x,
+                                                  V* angle) {
+  V a;
+  Atan<V, M>(y / x, &a);
+  const V turn = y < 0.0 ? a - kPi : a + kPi;
+  *angle = x < 0.0 ? turn : a;
+}
+
+}  // namespace lane
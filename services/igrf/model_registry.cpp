@@ -0,0 +1,84 @@
+#include "model_registry.h"
+
+#include <functional>
+#include <thread>
+#include <utility>
+
+ModelRegistry::ModelRegistry(std::string default_id)
+    : default_id_(std::move(default_id)), current_(new Catalog()) {
+  for (Slot& slot : slots_) {
+    slot.readers[0].store(0);
+    slot.readers[1].store(0);
+  }
+}
+
+ModelRegistry::~ModelRegistry() {
+  delete current_.load();
+}
+
+size_t ModelRegistry::SlotOf() {
+  static thread_local const size_t slot =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % kSlots;
+  return slot;
+}
+
+ModelRegistry::Reader::Reader(const ModelRegistry& registry)
+    : registry_(registry) {
+  // The count goes up before the catalog is loaded: a publisher that has
+  // stored a new catalog either sees this reader or is seen by it.
+  Slot& slot = registry.slots_[SlotOf()];
+  count_ = &slot.readers[registry.phase_.load() & 1];
+  count_->fetch_add(1);
+  catalog_ = registry.current_.load();
+}
+
+ModelRegistry::Reader::~Reader() {
+  count_->fetch_sub(1);
+}
+
+const ModelRegistry::Entry* ModelRegistry::Reader::EntryOf(
+    const std::string& id) const {
+  auto it = catalog_->models.find(id.empty() ? registry_.default_id_ : id);
+  return it == catalog_->models.end() ? nullptr : &it->second;
+}
+
+const IGRFModel* ModelRegistry::Reader::Find(const std::string& id,
+                                             uint64_t* serial) const {
+  const Entry* entry = EntryOf(id);
+  if (entry == nullptr) return nullptr;
+  if (serial != nullptr) *serial = entry->serial;
+  return entry->model.get();
+}
+
+std::shared_ptr<const IGRFModel> ModelRegistry::Acquire(
+    const std::string& id, uint64_t* serial) const {
+  // The read section lasts only as long as the copy.
+  const Reader reader(*this);
+  const Entry* entry = reader.EntryOf(id);
+  if (entry == nullptr) return nullptr;
+  if (serial != nullptr) *serial = entry->serial;
+  return entry->model;
+}
+
+void ModelRegistry::WaitForReaders(unsigned phase) const {
+  for (const Slot& slot : slots_) {
+    while (slot.readers[phase & 1].load() != 0) std::this_thread::yield();
+  }
+}
+
+void ModelRegistry::Publish(const std::string& id,
+                            std::unique_ptr<const IGRFModel> model) {
+  std::lock_guard<std::mutex> lock(publish_mutex_);
+  // The catalogs share the models they have in common.
+  auto catalog = std::make_unique<Catalog>(*current_.load());
+  catalog->models[id] = Entry{std::move(model), ++last_serial_};
+  const Catalog* previous = current_.exchange(catalog.release());
+  // Flip the phase twice, draining the one left behind each time. New
+  // readers go to the other phase, so neither wait can be starved, and a
+  // reader that picked its phase before a flip is drained by the other.
+  for (int i = 0; i < 2; ++i) {
+    const unsigned phase = phase_.fetch_add(1);
+    WaitForReaders(phase);
+  }
+  delete previous;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file model_registry.h
+ * @brief The coefficient models igrf_server answers from, replaceable while
+ * the server runs
+ *
+ * The models live in an immutable catalog keyed by model id. Readers pin
+ * the current catalog for the duration of a call without taking a lock.
+ * Publish swaps in a new catalog with one atomic store and then waits out
+ * the readers that may still hold the old one before freeing it, in the
+ * manner of RCU. Calls that last as long as their client lets them, the
+ * streams, would hold Publish up that long, so they Acquire their model
+ * instead, and a replaced model lives on until the last of them lets go.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "igrf_model.h"
+
+class ModelRegistry {
+  struct Entry;
+  struct Catalog;
+
+ public:
+  // `default_id` names the model used by requests that leave model_id
+  // empty.
+  explicit ModelRegistry(std::string default_id);
+  ~ModelRegistry();
+
+  ModelRegistry(const ModelRegistry&) = delete;
+  ModelRegistry& operator=(const ModelRegistry&) = delete;
+
+  const std::string& default_id() const { return default_id_; }
+
+  // The model named `id`, as Reader::Find, kept alive for as long as the
+  // caller holds it rather than for a read section. Costs a shared count
+  // update that Find does not.
+  std::shared_ptr<const IGRFModel> Acquire(const std::string& id,
+                                           uint64_t* serial = nullptr) const;
+
+  // Keeps the models current at construction alive until destroyed.
+  class Reader {
+   public:
+    explicit Reader(const ModelRegistry& registry);
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // The model named `id`, or the default one for an empty id; null when
+    // there is no such model. `serial`, when given, receives a number that
+    // no other model published to the registry ever shares.
+    const IGRFModel* Find(const std::string& id,
+                          uint64_t* serial = nullptr) const;
+
+   private:
+    friend class ModelRegistry;
+
+    // The entry Find answers from, or null.
+    const Entry* EntryOf(const std::string& id) const;
+
+    const ModelRegistry& registry_;
+    std::atomic<int64_t>* count_;
+    const Catalog* catalog_;
+  };
+
+  // Makes `model` current under `id`, adding the id if it is new. Returns
+  // once no reader can still see a model it replaced, which has been freed
+  // by then unless a caller of Acquire still holds it. Publishers are
+  // serialized; readers are never blocked.
+  void Publish(const std::string& id, std::unique_ptr<const IGRFModel> model);
+
+ private:
+  struct Entry {
+    std::shared_ptr<const IGRFModel> model;
+    uint64_t serial;
+  };
+  struct Catalog {
+    std::unordered_map<std::string, Entry> models;
+  };
+
+  // Readers count themselves in one of two phases, spread over several
+  // cache lines so that concurrent calls do not share one.
+  static constexpr size_t kSlots = 16;
+  struct alignas(64) Slot {
+    std::atomic<int64_t> readers[2];
+  };
+
+  static size_t SlotOf();
+  void WaitForReaders(unsigned phase) const;
+
+  const std::string default_id_;
+  std::atomic<const Catalog*> current_;
+  std::atomic<unsigned> phase_{0};
+  mutable Slot slots_[kSlots];
+  std::mutex publish_mutex_;
+  uint64_t last_serial_ = 0;  // guarded by publish_mutex_
+};
@@ -1,5 +1,15 @@
+// FillGaussian draws from Philox4x32-10 (Salmon et al. 2011, "Parallel
+// random numbers: as easy as 1, 2, 3", SC11): each 128-bit block is a keyed
+// bijection of its 64-bit index, so a vector of lanes computes consecutive
+// blocks independently, and Box-Muller turns each block into two normals.
 #include "noise_application.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "lane_math.h"
+
 TrueNoiseMixin::TrueNoiseMixin(): device(){}
 std::random_device& TrueNoiseMixin::get(){
   return device;
@@ -13,3 +23,156 @@ std::mt19937_64& PseudoNoiseMixin::get(){
   return device;
 }
 
+namespace {
+
+constexpr int kMaxWidth = 8;
+
+constexpr uint64_t kPhiloxM0 = 0xD2511F53;
+constexpr uint64_t kPhiloxM1 = 0xCD9E8D57;
+constexpr uint64_t kPhiloxW0 = 0x9E3779B9;
+constexpr uint64_t kPhiloxW1 = 0xBB67AE85;
+constexpr uint64_t kLow32 = 0xFFFFFFFF;
+constexpr int kPhiloxRounds = 10;
+
+constexpr double kTwoPi = 6.28318530717958647693;
+// Half of the spacing of the uniforms below keeps them inside (0, 1).
+constexpr double kHalfUlp = 1.0 / (1ULL << 53);
+
+// Writes the normals of `width` consecutive blocks from `block` on,
+// interleaved: out[2 i] and out[2 i + 1] come from block + i.
+using KernelFn = void (*)(uint64_t key, uint64_t block, double mean,
+                          double standard_deviation, double* out);
+
+struct Kernel {
+  KernelFn run;
+  size_t width;
+};
+
+// A double in (0, 1) from the high 52 bits of `bits`.
+double Uniform(uint64_t bits) {
+  const uint64_t one = 0x3FF0000000000000ULL | (bits >> 12);
+  double u;
+  std::memcpy(&u, &one, sizeof(u));
+  return u - 1.0 + kHalfUlp;
+}
+
+void ScalarBlock(uint64_t key, uint64_t block, double mean,
+                 double standard_deviation, double* out) {
+  uint64_t c0 = block & kLow32, c1 = block >> 32, c2 = 0, c3 = 0;
+  uint64_t k0 = key & kLow32, k1 = key >> 32;
+  for (int round = 0; round < kPhiloxRounds; ++round) {
+    const uint64_t p0 = kPhiloxM0 * c0, p1 = kPhiloxM1 * c2;
+    c0 = (p1 >> 32) ^ c1 ^ k0;
+    c1 = p1 & kLow32;
+    c2 = (p0 >> 32) ^ c3 ^ k1;
+    c3 = p0 & kLow32;
+    k0 = (k0 + kPhiloxW0) & kLow32;
+    k1 = (k1 + kPhiloxW1) & kLow32;
+  }
+  const double r =
+      standard_deviation * std::sqrt(-2.0 * std::log(Uniform(c0 << 32 | c1)));
+  const double theta = kTwoPi * Uniform(c2 << 32 | c3);
+  out[0] = mean + r * std::cos(theta);
+  out[1] = mean + r * std::sin(theta);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+using lane::Log;
+using lane::SinCos;
+using lane::Sqrt;
+
+// The 32-bit words of Philox sit in 64-bit lanes, where their products
+// are exact.
+template <typename V, typename M, typename U, int W>
+__attribute__((always_inline)) inline void GaussianLanes(
+    uint64_t key, uint64_t block, double mean, double standard_deviation,
+    double* out) {
+  U c0, c1;
+  for (int i = 0; i < W; ++i) {
+    c0[i] = (block + i) & kLow32;
+    c1[i] = (block + i) >> 32;
+  }
+  U c2 = {}, c3 = {};
+  uint64_t k0 = key & kLow32, k1 = key >> 32;
+  for (int round = 0; round < kPhiloxRounds; ++round) {
+    // The masks are no-ops, but let the compiler pick a 32-bit multiply.
+    const U p0 = kPhiloxM0 * (c0 & kLow32), p1 = kPhiloxM1 * (c2 & kLow32);
+    c0 = (p1 >> 32) ^ c1 ^ k0;
+    c1 = p1 & kLow32;
+    c2 = (p0 >> 32) ^ c3 ^ k1;
+    c3 = p0 & kLow32;
+    k0 = (k0 + kPhiloxW0) & kLow32;
+    k1 = (k1 + kPhiloxW1) & kLow32;
+  }
+  const U one = {};
+  const V u1 = (V)((one + 0x3FF0000000000000ULL) | (c0 << 20) | (c1 >> 12)) -
+               1.0 + kHalfUlp;
+  const V u2 = (V)((one + 0x3FF0000000000000ULL) | (c2 << 20) | (c3 >> 12)) -
+               1.0 + kHalfUlp;
+  V log_u1, r, sin_theta, cos_theta;
+  Log<V, M>(u1, &log_u1);
+  Sqrt<V, W>(-2.0 * log_u1, &r);
+  r = standard_deviation * r;
+  SinCos<V, M>(kTwoPi * u2, &sin_theta, &cos_theta);
+  const V first = mean + r * cos_theta;
+  const V second = mean + r * sin_theta;
+  for (int i = 0; i < W; ++i) {
+    out[2 * i] = first[i];
+    out[2 * i + 1] = second[i];
+  }
+}
+
+typedef double V4 __attribute__((vector_size(32)));
+typedef long long M4 __attribute__((vector_size(32)));
+typedef unsigned long long U4 __attribute__((vector_size(32)));
+typedef double V8 __attribute__((vector_size(64)));
+typedef long long M8 __attribute__((vector_size(64)));
+typedef unsigned long long U8 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2,fma"))) void Avx2Kernel(
+    uint64_t key, uint64_t block, double mean, double standard_deviation,
+    double* out) {
+  GaussianLanes<V4, M4, U4, 4>(key, block, mean, standard_deviation, out);
+}
+
+__attribute__((target("avx512f"))) void Avx512Kernel(
+    uint64_t key, uint64_t block, double mean, double standard_deviation,
+    double* out) {
+  GaussianLanes<V8, M8, U8, 8>(key, block, mean, standard_deviation, out);
+}
+
+Kernel SelectKernel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return {Avx512Kernel, 8};
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {Avx2Kernel, 4};
+  }
+  return {ScalarBlock, 1};
+}
+
+#else
+
+Kernel SelectKernel() {
+  return {ScalarBlock, 1};
+}
+
+#endif
+
+}  // namespace
+
+void FillGaussian(uint64_t key, uint64_t* counter, double mean,
+                  double standard_deviation, double* values, size_t count){
+  static const Kernel kernel = SelectKernel();
+  const size_t step = 2 * kernel.width;
+  size_t i = 0;
+  for (; i + step <= count; i += step) {
+    kernel.run(key, *counter, mean, standard_deviation, values + i);
+    *counter += kernel.width;
+  }
+  if (i == count) return;
+  double tail[2 * kMaxWidth];
+  kernel.run(key, *counter, mean, standard_deviation, tail);
+  std::copy(tail, tail + (count - i), values + i);
+  *counter += (count - i + 1) / 2;
+}
@@ -1,6 +1,15 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <random>
 
+// Writes `count` normal deviates to `values`, two from each Philox4x32-10
+// block of `key` from *counter on, and advances *counter past the blocks
+// used. Vectorized where the CPU allows; the same key and counter give the
+// same deviates on every kernel, to within a few units in the last place.
+void FillGaussian(uint64_t key, uint64_t* counter, double mean,
+                  double standard_deviation, double* values, size_t count);
+
 
 template<class Generator>
 struct NoiseMixin{
@@ -59,6 +68,22 @@ public:
     
     return dist(Noise<TypeMixin>::mixin.get());
   }
+
+  // Bulk counterpart of Apply() through FillGaussian, keyed by the first
+  // two draws of the mixin's generator. Cheaper per deviate than Apply()
+  // from a few dozen on, but a separate stream from it.
+  void Fill(double* values, size_t count){
+    if (!keyed) {
+      auto& generator = Noise<TypeMixin>::mixin.get();
+      key = static_cast<uint64_t>(generator()) << 32;
+      key ^= static_cast<uint64_t>(generator());
+      keyed = true;
+    }
+    FillGaussian(key, &counter, dist.mean(), dist.stddev(), values, count);
+  }
 private:
   std::normal_distribution<> dist;
+  bool keyed = false;
+  uint64_t key = 0;
+  uint64_t counter = 0;
 };
\ No newline at end of file
@@ -0,0 +1,57 @@
+/**
+ * @file noise_application_test.cpp
+ * @brief In-process tests of the bulk Philox Gaussian generator
+ */
+#include "noise_application.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../testing/catch.hpp"
+
+namespace {
+
+constexpr uint64_t kKey = 0x9e3779b97f4a7c15ULL;
+
+}  // namespace
+
+TEST_CASE("FillGaussian draws normal deviates reproducibly",
+          "[noise_application]") {
+  // A million deviates of mean 1 and deviation 2, an odd count so that the
+  // last block is half used.
+  std::vector<double> deviates(1000001);
+  uint64_t counter = 0;
+  FillGaussian(kKey, &counter, 1.0, 2.0, deviates.data(), deviates.size());
+  REQUIRE(counter == 500001);
+
+  SECTION("They have the moments of that distribution") {
+    double sum = 0, squares = 0, fourths = 0;
+    for (double deviate : deviates) {
+      const double z = (deviate - 1.0) / 2.0;
+      sum += z;
+      squares += z * z;
+      fourths += z * z * z * z;
+    }
+    const double n = deviates.size();
+    REQUIRE(std::abs(sum / n) < 5e-3);
+    REQUIRE(std::abs(squares / n - 1.0) < 5e-3);
+    REQUIRE(std::abs(fourths / n - 3.0) < 3e-2);
+  }
+
+  SECTION("Filling them in uneven pieces gives the same deviates") {
+    std::vector<double> pieces(deviates.size());
+    uint64_t piece_counter = 0;
+    size_t filled = 0;
+    for (size_t size = 2; filled < pieces.size(); size += 6) {
+      size = std::min(size, pieces.size() - filled);
+      FillGaussian(kKey, &piece_counter, 1.0, 2.0, pieces.data() + filled,
+                   size);
+      filled += size;
+    }
+    REQUIRE(pieces == deviates);
+    REQUIRE(piece_counter == counter);
+  }
+}
@@ -0,0 +1,47 @@
+#include "result_cache.h"
+
+#include <cmath>
+#include <functional>
+
+namespace {
+
+constexpr double kAngleQuantum = 1e7;
+constexpr double kAltitudeQuantum = 1e5;
+
+}  // namespace
+
+bool ResultCache::Key::operator==(const Key& other) const {
+  return model == other.model && degree == other.degree &&
+         coord_type == other.coord_type &&
+         altitude_type == other.altitude_type && sdate == other.sdate &&
+         latitude == other.latitude && longitude == other.longitude &&
+         altitude == other.altitude;
+}
+
+size_t ResultCache::KeyHash::operator()(const Key& key) const {
+  size_t hash = std::hash<uint64_t>()(key.model);
+  hash = HashCombine(hash, std::hash<int32_t>()(key.degree));
+  hash = HashCombine(hash, std::hash<char>()(key.coord_type));
+  hash = HashCombine(hash, std::hash<char>()(key.altitude_type));
+  hash = HashCombine(hash, std::hash<double>()(key.sdate));
+  hash = HashCombine(hash, std::hash<int64_t>()(key.latitude));
+  hash = HashCombine(hash, std::hash<int64_t>()(key.longitude));
+  return HashCombine(hash, std::hash<int64_t>()(key.altitude));
+}
+
+ResultCache::ResultCache(size_t capacity, size_t shards)
+    : entries_(capacity, shards) {}
+
+ResultCache::Key ResultCache::MakeKey(uint64_t model, int degree,
+                                      const IGRFModel::Request& request) {
+  Key key;
+  key.model = model;
+  key.degree = degree;
+  key.coord_type = request.coord_type;
+  key.altitude_type = request.altitude_type;
+  key.sdate = request.sdate;
+  key.latitude = std::llround(request.latitude * kAngleQuantum);
+  key.longitude = std::llround(request.longitude * kAngleQuantum);
+  key.altitude = std::llround(request.altitude * kAltitudeQuantum);
+  return key;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file result_cache.h
+ * @brief Bounded LRU cache of evaluated points for igrf_server
+ *
+ * Entries are keyed on the model, the degree of the expansion, the date and
+ * the position quantized to about a centimeter, so repeated queries for the
+ * same point are answered without evaluating the model again. The entries
+ * live in a ShardedLru.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "igrf_model.h"
+#include "sharded_lru.h"
+
+class ResultCache {
+ public:
+  struct Key {
+    uint64_t model;  // ModelRegistry serial
+    int32_t degree;
+    char coord_type;
+    char altitude_type;
+    double sdate;
+    int64_t latitude;   // 1e-7 degrees
+    int64_t longitude;  // 1e-7 degrees
+    int64_t altitude;   // 1e-5 of the altitude unit
+
+    bool operator==(const Key& other) const;
+  };
+
+  struct Value {
+    igrf_computation computation;
+    double truncation_bound;
+  };
+
+  // Holds at most `capacity` entries over `shards` shards.
+  ResultCache(size_t capacity, size_t shards);
+
+  ResultCache(const ResultCache&) = delete;
+  ResultCache& operator=(const ResultCache&) = delete;
+
+  static Key MakeKey(uint64_t model, int degree,
+                     const IGRFModel::Request& request);
+
+  // Copies the entry for `key` into `value` and marks it most recently used.
+  bool Lookup(const Key& key, Value* value) {
+    return entries_.Lookup(key, value);
+  }
+  void Insert(const Key& key, const Value& value) {
+    entries_.Insert(key, value);
+  }
+
+  size_t capacity() const { return entries_.capacity(); }
+  size_t size() const { return entries_.size(); }
+  uint64_t hits() const { return entries_.hits(); }
+  uint64_t misses() const { return entries_.misses(); }
+  uint64_t evictions() const { return entries_.evictions(); }
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  ShardedLru<Key, Value, KeyHash> entries_;
+};
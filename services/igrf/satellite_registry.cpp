@@ -0,0 +1,35 @@
+#include "satellite_registry.h"
+
+#include <stdexcept>
+#include <utility>
+
+#include "sgp4/include/Tle.h"
+
+std::string SatelliteRegistry::Add(const std::string& title,
+                                   const std::string& first,
+                                   const std::string& second,
+                                   std::string* error) {
+  std::shared_ptr<const SGP4Batch> satellite;
+  try {
+    satellite = std::make_shared<const SGP4Batch>(Tle(title, first, second));
+  } catch (const std::exception& e) {
+    *error = e.what();
+    return std::string();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string id = "tle-" + std::to_string(++last_id_);
+  satellites_.emplace(id, std::move(satellite));
+  return id;
+}
+
+std::shared_ptr<const SGP4Batch> SatelliteRegistry::Find(
+    const std::string& id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = satellites_.find(id);
+  return it != satellites_.end() ? it->second : nullptr;
+}
+
+bool SatelliteRegistry::Remove(const std::string& id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return satellites_.erase(id) > 0;
+}
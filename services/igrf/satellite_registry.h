@@ -0,0 +1,42 @@
+/**
+ * @file satellite_registry.h
+ * @brief SGP4 propagators igrf_server keeps in process when it runs without
+ * an SGP service
+ *
+ * construct registers a TLE here under a new computational id, computeTLE
+ * propagates it on the calling thread, all of a request's instants at once,
+ * and endWork drops it again.
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "sgp4_batch.h"
+
+class SatelliteRegistry {
+ public:
+  SatelliteRegistry() = default;
+  SatelliteRegistry(const SatelliteRegistry&) = delete;
+  SatelliteRegistry& operator=(const SatelliteRegistry&) = delete;
+
+  // Parses the TLE and keeps a propagator for it. Returns the id it is kept
+  // under, or an empty string with the reason in `error`.
+  std::string Add(const std::string& title, const std::string& first,
+                  const std::string& second, std::string* error);
+
+  // Null for an unknown id. A propagator removed meanwhile stays usable for
+  // as long as the pointer is held.
+  std::shared_ptr<const SGP4Batch> Find(const std::string& id) const;
+
+  bool Remove(const std::string& id);
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const SGP4Batch>>
+      satellites_;
+  uint64_t last_id_ = 0;
+};
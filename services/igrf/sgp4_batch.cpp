@@ -0,0 +1,758 @@
+// Vectorized FindPositionSGP4: the near-space branch of the SGP4 library,
+// with every variable that depends on the time widened to one lane per
+// instant. The order of the arithmetic follows the library term by term;
+// sin and cos are evaluated lane-wise (lane_math.h), so a lane agrees with
+// the scalar propagator to within a few units in the last place of the
+// angles.
+#include "sgp4_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <optional>
+
+#include "sgp4/include/Eci.h"
+#include "sgp4/include/Globals.h"
+#include "sgp4/include/Vector.h"
+#include "lane_math.h"
+
+namespace {
+
+constexpr int kMaxWidth = 8;
+constexpr int kKeplerIterations = 10;
+
+// The terms of SGP4Batch::Constants the lanes read. Kernels take them term
+// by term: lane i of term t is terms[t * stride + i].
+#define SGP4_TERMS(X)                                                        \
+  X(xmo) X(xnodeo) X(omegao) X(eo) X(xincl) X(bstar) X(aodp) X(xnodp)        \
+  X(cosio) X(sinio) X(eta) X(t2cof) X(x1mth2) X(x3thm1) X(x7thm1) X(aycof)   \
+  X(xlcof) X(xnodcf) X(c1) X(c4) X(omgdot) X(xnodot) X(xmdot) X(c5)          \
+  X(omgcof) X(xmcof) X(delmo) X(sinmo) X(d2) X(d3) X(d4) X(t3cof) X(t4cof)   \
+  X(t5cof) X(simple) X(deep)
+
+namespace term {
+#define SGP4_TERM_INDEX(name) name,
+enum : size_t { SGP4_TERMS(SGP4_TERM_INDEX) kCount };
+#undef SGP4_TERM_INDEX
+}  // namespace term
+
+void Scatter(const SGP4Batch::Constants& c, double* terms, size_t stride) {
+#define SGP4_TERM_STORE(name) terms[term::name * stride] = c.name;
+  SGP4_TERMS(SGP4_TERM_STORE)
+#undef SGP4_TERM_STORE
+}
+
+// Writes lane i of each state component to out[component][i]. Returns a
+// bit per lane that could not be settled and has to be redone by
+// SGP4::FindPosition.
+using KernelFn = unsigned (*)(const double* terms, size_t stride,
+                              const double* tsince, double* const* out);
+
+struct Kernel {
+  KernelFn run;
+  size_t width;
+};
+
+void Store(const Eci& eci, size_t i, SGP4Batch::States* states) {
+  const Vector& position = eci.Position();
+  const Vector& velocity = eci.Velocity();
+  states->x[i] = position.x;
+  states->y[i] = position.y;
+  states->z[i] = position.z;
+  states->vx[i] = velocity.x;
+  states->vy[i] = velocity.y;
+  states->vz[i] = velocity.z;
+}
+
+// A propagated instant of PropagateDense, with the velocity in km/min to
+// match the minutes of t.
+struct Knot {
+  double t;
+  double p[3];
+  double v[3];
+};
+
+// The cubic Hermite interpolant between knots a and b at t, and its
+// derivative.
+void Hermite(const Knot& a, const Knot& b, double t, double* p, double* v) {
+  const double h = b.t - a.t;
+  const double s = (t - a.t) / h;
+  const double s2 = s * s;
+  const double h00 = (1.0 + 2.0 * s) * (1.0 - s) * (1.0 - s);
+  const double h10 = s * (1.0 - s) * (1.0 - s) * h;
+  const double h01 = s2 * (3.0 - 2.0 * s);
+  const double h11 = s2 * (s - 1.0) * h;
+  const double d00 = 6.0 * (s2 - s) / h;
+  const double d10 = 3.0 * s2 - 4.0 * s + 1.0;
+  const double d11 = 3.0 * s2 - 2.0 * s;
+  for (int k = 0; k < 3; ++k) {
+    p[k] = h00 * a.p[k] + h10 * a.v[k] + h01 * b.p[k] + h11 * b.v[k];
+    v[k] = d00 * (a.p[k] - b.p[k]) + d10 * a.v[k] + d11 * b.v[k];
+  }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+using lane::All;
+using lane::Any;
+using lane::Floor;
+using lane::SinCos;
+using lane::Sqrt;
+
+// One vector per term, lane i belonging to the satellite of lane i.
+template <typename V>
+struct Lanes {
+#define SGP4_TERM_LANES(name) V name;
+  SGP4_TERMS(SGP4_TERM_LANES)
+#undef SGP4_TERM_LANES
+};
+
+// FindPositionSGP4 followed by CalculateFinalPositionVelocity for W
+// instants, of one satellite or of W of them; V is a GCC vector of W
+// doubles and M the matching comparison mask. Always inlined so that it is
+// compiled for the target of the kernel that instantiates it.
+template <typename V, typename M, int W>
+__attribute__((always_inline)) inline unsigned PropagateLanes(
+    const double* terms, size_t stride, const double* at, double* const* out) {
+  Lanes<V> c;
+  V tsince;
+  for (int i = 0; i < W; ++i) {
+#define SGP4_TERM_LOAD(name) c.name[i] = terms[term::name * stride + i];
+    SGP4_TERMS(SGP4_TERM_LOAD)
+#undef SGP4_TERM_LOAD
+    tsince[i] = at[i];
+  }
+  const V zero = {};
+
+  const V xmdf = c.xmo + c.xmdot * tsince;
+  const V omgadf = c.omegao + c.omgdot * tsince;
+  const V xnoddf = c.xnodeo + c.xnodot * tsince;
+  V omega = omgadf;
+  V xmp = xmdf;
+  const V tsq = tsince * tsince;
+  const V xnode = xnoddf + c.xnodcf * tsq;
+  V tempa = 1.0 - c.c1 * tsince;
+  V tempe = c.bstar * c.c4 * tsince;
+  V templ = c.t2cof * tsq;
+  const M simple = c.simple != 0.0;
+  if (!All<M, W>(simple)) {
+    const V delomg = c.omgcof * tsince;
+    V sin_xmdf, cos_xmdf;
+    SinCos<V, M>(xmdf, &sin_xmdf, &cos_xmdf);
+    const V eta_term = 1.0 + c.eta * cos_xmdf;
+    const V delm = c.xmcof * (eta_term * eta_term * eta_term - c.delmo);
+    const V temp = delomg + delm;
+    const V full_xmp = xmdf + temp;
+    omega = simple ? omega : omgadf - temp;
+    const V tcube = tsq * tsince;
+    const V tfour = tsince * tcube;
+    tempa = simple ? tempa : tempa - c.d2 * tsq - c.d3 * tcube - c.d4 * tfour;
+    V sin_xmp, cos_xmp;
+    SinCos<V, M>(full_xmp, &sin_xmp, &cos_xmp);
+    tempe = simple ? tempe : tempe + c.bstar * c.c5 * (sin_xmp - c.sinmo);
+    templ = simple ? templ
+                   : templ + c.t3cof * tcube +
+                         tfour * (c.t4cof + tsince * c.t5cof);
+    xmp = simple ? xmp : full_xmp;
+  }
+  const V a = c.aodp * tempa * tempa;
+  V e = c.eo - tempe;
+  const V xl = xmp + omega + xnode + c.xnodp * templ;
+  M unsettled = (e <= -0.001) | (c.deep != 0.0);
+  e = e < 1.0e-6 ? zero + 1.0e-6 : e;
+  e = e > (1.0 - 1.0e-6) ? zero + (1.0 - 1.0e-6) : e;
+
+  V sqrt_a;
+  Sqrt<V, W>(a, &sqrt_a);
+  const V beta2 = 1.0 - e * e;
+  const V xn = kXKE / (a * sqrt_a);
+  V sin_omega, cos_omega;
+  SinCos<V, M>(omega, &sin_omega, &cos_omega);
+  const V axn = e * cos_omega;
+  const V temp11 = 1.0 / (a * beta2);
+  const V xll = temp11 * c.xlcof * axn;
+  const V aynl = temp11 * c.aycof;
+  const V xlt = xl + xll;
+  const V ayn = e * sin_omega + aynl;
+  const V elsq = axn * axn + ayn * ayn;
+  unsettled |= elsq >= 1.0;
+
+  // Kepler's equation: each lane stops once its own residual is small, and
+  // keeps the sines of the iterate it stopped at, as the scalar loop does.
+  const V xlt_node = xlt - xnode;
+  V turns;
+  Floor(xlt_node / kTWOPI, &turns);
+  const V capu = xlt_node - kTWOPI * turns;
+  V epw = capu;
+  V sinepw = zero, cosepw = zero, ecose = zero, esine = zero;
+  V max_newton_raphson;
+  Sqrt<V, W>(elsq, &max_newton_raphson);
+  max_newton_raphson *= 1.25;
+  M running = zero == zero;
+  for (int i = 0; i < kKeplerIterations; ++i) {
+    V sin_epw, cos_epw;
+    SinCos<V, M>(epw, &sin_epw, &cos_epw);
+    sinepw = running ? sin_epw : sinepw;
+    cosepw = running ? cos_epw : cosepw;
+    ecose = running ? axn * cos_epw + ayn * sin_epw : ecose;
+    esine = running ? axn * sin_epw - ayn * cos_epw : esine;
+    const V f = capu - epw + esine;
+    running &= (f < 0.0 ? -f : f) >= 1.0e-12;
+    if (!Any<M, W>(running)) break;
+    const V fdot = 1.0 - ecose;
+    V delta_epw = f / fdot;
+    if (i == 0) {
+      delta_epw = delta_epw > max_newton_raphson ? max_newton_raphson
+                                                 : delta_epw;
+      delta_epw = delta_epw < -max_newton_raphson ? -max_newton_raphson
+                                                  : delta_epw;
+    } else {
+      delta_epw = f / (fdot + 0.5 * esine * delta_epw);
+    }
+    epw = running ? epw + delta_epw : epw;
+  }
+
+  const V temp21 = 1.0 - elsq;
+  const V pl = a * temp21;
+  unsettled |= pl < 0.0;
+  const V r = a * (1.0 - ecose);
+  const V temp31 = 1.0 / r;
+  V sqrt_pl, betal;
+  Sqrt<V, W>(pl, &sqrt_pl);
+  Sqrt<V, W>(temp21, &betal);
+  const V rdot = kXKE * sqrt_a * esine * temp31;
+  const V rfdot = kXKE * sqrt_pl * temp31;
+  const V temp32 = a * temp31;
+  const V temp33 = 1.0 / (1.0 + betal);
+  const V cosu = temp32 * (cosepw - axn + ayn * esine * temp33);
+  const V sinu = temp32 * (sinepw - ayn - axn * esine * temp33);
+  const V sin2u = 2.0 * sinu * cosu;
+  const V cos2u = 2.0 * cosu * cosu - 1.0;
+  const V temp41 = 1.0 / pl;
+  const V temp42 = kCK2 * temp41;
+  const V temp43 = temp42 * temp41;
+  const V rk = r * (1.0 - 1.5 * temp43 * betal * c.x3thm1) +
+               0.5 * temp42 * c.x1mth2 * cos2u;
+  const V xnodek = xnode + 1.5 * temp43 * c.cosio * sin2u;
+  const V xinck = c.xincl + 1.5 * temp43 * c.cosio * c.sinio * cos2u;
+  const V rdotk = rdot - xn * temp42 * c.x1mth2 * sin2u;
+  const V rfdotk = rfdot + xn * temp42 * (c.x1mth2 * cos2u + 1.5 * c.x3thm1);
+  unsettled |= rk < 1.0;
+
+  // uk = atan2(sinu, cosu) - du; its sine and cosine follow from the angle
+  // difference without going through the angle.
+  const V du = 0.25 * temp43 * c.x7thm1 * sin2u;
+  V norm;
+  Sqrt<V, W>(sinu * sinu + cosu * cosu, &norm);
+  norm = 1.0 / norm;
+  V sin_du, cos_du, sinik, cosik, sinnok, cosnok;
+  SinCos<V, M>(du, &sin_du, &cos_du);
+  SinCos<V, M>(xinck, &sinik, &cosik);
+  SinCos<V, M>(xnodek, &sinnok, &cosnok);
+  const V sinuk = (sinu * cos_du - cosu * sin_du) * norm;
+  const V cosuk = (cosu * cos_du + sinu * sin_du) * norm;
+  const V xmx = -sinnok * cosik;
+  const V xmy = cosnok * cosik;
+  const V ux = xmx * sinuk + cosnok * cosuk;
+  const V uy = xmy * sinuk + sinnok * cosuk;
+  const V uz = sinik * sinuk;
+  const V vx = xmx * cosuk - cosnok * sinuk;
+  const V vy = xmy * cosuk - sinnok * sinuk;
+  const V vz = sinik * cosuk;
+  const V x = rk * ux * kXKMPER;
+  const V y = rk * uy * kXKMPER;
+  const V z = rk * uz * kXKMPER;
+  const V xdot = (rdotk * ux + rfdotk * vx) * (kXKMPER / 60.0);
+  const V ydot = (rdotk * uy + rfdotk * vy) * (kXKMPER / 60.0);
+  const V zdot = (rdotk * uz + rfdotk * vz) * (kXKMPER / 60.0);
+
+  unsigned redo = 0;
+  for (int i = 0; i < W; ++i) {
+    out[0][i] = x[i];
+    out[1][i] = y[i];
+    out[2][i] = z[i];
+    out[3][i] = xdot[i];
+    out[4][i] = ydot[i];
+    out[5][i] = zdot[i];
+    if (unsettled[i]) redo |= 1u << i;
+  }
+  return redo;
+}
+
+typedef double V4 __attribute__((vector_size(32)));
+typedef long long M4 __attribute__((vector_size(32)));
+typedef double V8 __attribute__((vector_size(64)));
+typedef long long M8 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2,fma"))) unsigned Avx2Kernel(
+    const double* terms, size_t stride, const double* tsince,
+    double* const* out) {
+  return PropagateLanes<V4, M4, 4>(terms, stride, tsince, out);
+}
+
+__attribute__((target("avx512f"))) unsigned Avx512Kernel(
+    const double* terms, size_t stride, const double* tsince,
+    double* const* out) {
+  return PropagateLanes<V8, M8, 8>(terms, stride, tsince, out);
+}
+
+Kernel SelectKernel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return {Avx512Kernel, 8};
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {Avx2Kernel, 4};
+  }
+  return {nullptr, 1};
+}
+
+#else
+
+Kernel SelectKernel() {
+  return {nullptr, 1};
+}
+
+#endif
+
+}  // namespace
+
+void SGP4Batch::States::Resize(size_t count) {
+  x.resize(count);
+  y.resize(count);
+  z.resize(count);
+  vx.resize(count);
+  vy.resize(count);
+  vz.resize(count);
+}
+
+SGP4Batch::SGP4Batch(const Tle& tle)
+    : sgp4_(tle),
+      elements_(tle),
+      constants_(Derive(elements_)),
+      terms_(term::kCount * kMaxWidth) {
+  // Every lane reads the same satellite.
+  for (size_t i = 0; i < kMaxWidth; ++i) {
+    Scatter(constants_, terms_.data() + i, kMaxWidth);
+  }
+  if (constants_.deep) checkpoints_.emplace(0, sgp4_);
+}
+
+// SGP4::Initialise without the deep-space part.
+SGP4Batch::Constants SGP4Batch::Derive(const OrbitalElements& elements) {
+  Constants c = {};
+  const double eo = elements.Eccentricity();
+  const double aodp = elements.RecoveredSemiMajorAxis();
+  const double xnodp = elements.RecoveredMeanMotion();
+  const double bstar = elements.BStar();
+  const double perigee = elements.Perigee();
+  c.xmo = elements.MeanAnomoly();
+  c.xnodeo = elements.AscendingNode();
+  c.omegao = elements.ArgumentPerigee();
+  c.eo = eo;
+  c.xincl = elements.Inclination();
+  c.bstar = bstar;
+  c.aodp = aodp;
+  c.xnodp = xnodp;
+  c.simple = perigee < 220.0;
+  c.deep = elements.Period() >= 225.0;
+
+  c.cosio = std::cos(c.xincl);
+  c.sinio = std::sin(c.xincl);
+  const double theta2 = c.cosio * c.cosio;
+  c.x3thm1 = 3.0 * theta2 - 1.0;
+  const double eosq = eo * eo;
+  const double betao2 = 1.0 - eosq;
+  const double betao = std::sqrt(betao2);
+
+  double s4 = kS;
+  double qoms24 = kQOMS2T;
+  if (perigee < 156.0) {
+    s4 = perigee - 78.0;
+    if (perigee < 98.0) s4 = 20.0;
+    qoms24 = std::pow((120.0 - s4) * kAE / kXKMPER, 4.0);
+    s4 = s4 / kXKMPER + kAE;
+  }
+
+  const double pinvsq = 1.0 / (aodp * aodp * betao2 * betao2);
+  const double tsi = 1.0 / (aodp - s4);
+  c.eta = aodp * eo * tsi;
+  const double etasq = c.eta * c.eta;
+  const double eeta = eo * c.eta;
+  const double psisq = std::fabs(1.0 - etasq);
+  const double coef = qoms24 * std::pow(tsi, 4.0);
+  const double coef1 = coef / std::pow(psisq, 3.5);
+  const double c2 =
+      coef1 * xnodp *
+      (aodp * (1.0 + 1.5 * etasq + eeta * (4.0 + etasq)) +
+       0.75 * kCK2 * tsi / psisq * c.x3thm1 *
+           (8.0 + 3.0 * etasq * (8.0 + etasq)));
+  c.c1 = bstar * c2;
+  const double a3ovk2 = -kXJ3 / kCK2 * kAE * kAE * kAE;
+  c.x1mth2 = 1.0 - theta2;
+  c.c4 = 2.0 * xnodp * coef1 * aodp * betao2 *
+         (c.eta * (2.0 + 0.5 * etasq) + eo * (0.5 + 2.0 * etasq) -
+          2.0 * kCK2 * tsi / (aodp * psisq) *
+              (-3.0 * c.x3thm1 * (1.0 - 2.0 * eeta + etasq * (1.5 - 0.5 * eeta)) +
+               0.75 * c.x1mth2 * (2.0 * etasq - eeta * (1.0 + etasq)) *
+                   std::cos(2.0 * c.omegao)));
+  const double theta4 = theta2 * theta2;
+  const double temp1 = 3.0 * kCK2 * pinvsq * xnodp;
+  const double temp2 = temp1 * kCK2 * pinvsq;
+  const double temp3 = 1.25 * kCK4 * pinvsq * pinvsq * xnodp;
+  c.xmdot = xnodp + 0.5 * temp1 * betao * c.x3thm1 +
+            0.0625 * temp2 * betao * (13.0 - 78.0 * theta2 + 137.0 * theta4);
+  const double x1m5th = 1.0 - 5.0 * theta2;
+  c.omgdot = -0.5 * temp1 * x1m5th +
+             0.0625 * temp2 * (7.0 - 114.0 * theta2 + 395.0 * theta4) +
+             temp3 * (3.0 - 36.0 * theta2 + 49.0 * theta4);
+  const double xhdot1 = -temp1 * c.cosio;
+  c.xnodot = xhdot1 + (0.5 * temp2 * (4.0 - 19.0 * theta2) +
+                       2.0 * temp3 * (3.0 - 7.0 * theta2)) * c.cosio;
+  c.xnodcf = 3.5 * betao2 * xhdot1 * c.c1;
+  c.t2cof = 1.5 * c.c1;
+  const double xlcof_den =
+      std::fabs(c.cosio + 1.0) > 1.5e-12 ? 1.0 + c.cosio : 1.5e-12;
+  c.xlcof = 0.125 * a3ovk2 * c.sinio * (3.0 + 5.0 * c.cosio) / xlcof_den;
+  c.aycof = 0.25 * a3ovk2 * c.sinio;
+  c.x7thm1 = 7.0 * theta2 - 1.0;
+
+  double c3 = 0.0;
+  if (eo > 1.0e-4) c3 = coef * tsi * a3ovk2 * xnodp * kAE * c.sinio / eo;
+  c.c5 = 2.0 * coef1 * aodp * betao2 *
+         (1.0 + 2.75 * (etasq + eeta) + eeta * etasq);
+  c.omgcof = bstar * c3 * std::cos(c.omegao);
+  c.xmcof = 0.0;
+  if (eo > 1.0e-4) c.xmcof = -kTWOTHIRD * coef * bstar * kAE / eeta;
+  c.delmo = std::pow(1.0 + c.eta * std::cos(c.xmo), 3.0);
+  c.sinmo = std::sin(c.xmo);
+  if (!c.simple) {
+    const double c1sq = c.c1 * c.c1;
+    c.d2 = 4.0 * aodp * tsi * c1sq;
+    const double temp = c.d2 * tsi * c.c1 / 3.0;
+    c.d3 = (17.0 * aodp + s4) * temp;
+    c.d4 = 0.5 * temp * aodp * tsi * (221.0 * aodp + 31.0 * s4) * c.c1;
+    c.t3cof = c.d2 + 2.0 * c1sq;
+    c.t4cof = 0.25 * (3.0 * c.d3 + c.c1 * (12.0 * c.d2 + 10.0 * c1sq));
+    c.t5cof = 0.2 * (3.0 * c.d4 + 12.0 * c.c1 * c.d3 + 6.0 * c.d2 * c.d2 +
+                     15.0 * c1sq * (2.0 * c.d2 + c1sq));
+  }
+  return c;
+}
+
+void SGP4Batch::Propagate(const double* tsince, size_t count,
+                          States* states) const {
+  static const Kernel kernel = SelectKernel();
+  states->Resize(count);
+  size_t i = 0;
+  if (!constants_.deep && kernel.run != nullptr) {
+    double* out[6];
+    const auto redo = [&](unsigned lanes, size_t base, size_t width) {
+      for (size_t j = 0; j < width; ++j) {
+        if (lanes & (1u << j)) {
+          Store(sgp4_.FindPosition(tsince[base + j]), base + j, states);
+        }
+      }
+    };
+    for (; i + kernel.width <= count; i += kernel.width) {
+      out[0] = states->x.data() + i;
+      out[1] = states->y.data() + i;
+      out[2] = states->z.data() + i;
+      out[3] = states->vx.data() + i;
+      out[4] = states->vy.data() + i;
+      out[5] = states->vz.data() + i;
+      redo(kernel.run(terms_.data(), kMaxWidth, tsince + i, out), i,
+           kernel.width);
+    }
+    if (i < count) {
+      // Pad the tail with copies of its last instant to fill a whole vector.
+      double tail[kMaxWidth], tail_out[6][kMaxWidth];
+      const size_t rest = count - i;
+      for (size_t j = 0; j < kernel.width; ++j) {
+        tail[j] = tsince[i + std::min(j, rest - 1)];
+      }
+      for (int k = 0; k < 6; ++k) out[k] = tail_out[k];
+      const unsigned lanes = kernel.run(terms_.data(), kMaxWidth, tail, out);
+      for (size_t j = 0; j < rest; ++j) {
+        states->x[i + j] = tail_out[0][j];
+        states->y[i + j] = tail_out[1][j];
+        states->z[i + j] = tail_out[2][j];
+        states->vx[i + j] = tail_out[3][j];
+        states->vy[i + j] = tail_out[4][j];
+        states->vz[i + j] = tail_out[5][j];
+      }
+      redo(lanes, i, rest);
+      i = count;
+    }
+  }
+  if (!constants_.deep) {
+    for (; i < count; ++i) Store(sgp4_.FindPosition(tsince[i]), i, states);
+    return;
+  }
+  std::optional<SGP4> integrator;
+  for (; i < count; ++i) {
+    // Within the run of instants moving away from the epoch, the integrator
+    // carries on from the previous instant.
+    if (i == 0 || tsince[i] * tsince[i - 1] <= 0.0 ||
+        std::abs(tsince[i]) < std::abs(tsince[i - 1])) {
+      integrator.emplace(Resume(tsince[i]));
+    }
+    Store(integrator->FindPosition(tsince[i]), i, states);
+  }
+}
+
+SGP4 SGP4Batch::Resume(double tsince) const {
+  const int64_t last = static_cast<int64_t>(tsince / kCheckpointMinutes);
+  const int64_t step = last < 0 ? -1 : 1;
+  int64_t stride, furthest, i;
+  std::optional<SGP4> sgp4;
+  {
+    std::lock_guard<std::mutex> lock(checkpoints_mutex_);
+    stride = checkpoint_stride_;
+    furthest = step > 0 ? checkpoints_.rbegin()->first
+                        : checkpoints_.begin()->first;
+    // Division truncates towards the epoch, onto a checkpoint.
+    i = (step > 0 ? std::min(last, furthest) : std::max(last, furthest)) /
+        stride * stride;
+    sgp4.emplace(checkpoints_.at(i));
+  }
+  // Only the checkpoints right past the furthest one can be added.
+  std::vector<std::pair<int64_t, SGP4>> passed;
+  while (i != last) {
+    i += step;
+    try {
+      // Stops the integrator exactly at the checkpoint, a whole number of
+      // steps from the epoch.
+      sgp4->FindPosition(i * kCheckpointMinutes);
+    } catch (const std::exception&) {
+      // The orbit is unusable there; the integrator still stands on the
+      // path from the epoch, so FindPosition can carry on from it.
+      break;
+    }
+    if (i % stride == 0 && i * step > furthest * step &&
+        passed.size() < kMaxCheckpoints) {
+      passed.emplace_back(i, *sgp4);
+    }
+  }
+  if (passed.empty()) return *sgp4;
+  std::lock_guard<std::mutex> lock(checkpoints_mutex_);
+  // Another call may have got further, or thinned the checkpoints, since;
+  // keep the ones that extend them without a gap.
+  furthest = step > 0 ? checkpoints_.rbegin()->first
+                      : checkpoints_.begin()->first;
+  for (const auto& [at, checkpoint] : passed) {
+    if (at == furthest + step * checkpoint_stride_) {
+      checkpoints_.emplace(at, checkpoint);
+      furthest = at;
+    }
+  }
+  while (checkpoints_.size() > kMaxCheckpoints) {
+    checkpoint_stride_ *= 2;
+    for (auto it = checkpoints_.begin(); it != checkpoints_.end();) {
+      it = it->first % checkpoint_stride_ != 0 ? checkpoints_.erase(it)
+                                               : std::next(it);
+    }
+  }
+  return *sgp4;
+}
+
+size_t SGP4Batch::checkpoint_count() const {
+  std::lock_guard<std::mutex> lock(checkpoints_mutex_);
+  return checkpoints_.size();
+}
+
+void SGP4Batch::PropagateDense(const double* tsince, size_t count,
+                               double tolerance, States* states) const {
+  const double span = count > 0 ? tsince[count - 1] - tsince[0] : 0.0;
+  // The fourth derivative of the position, as on a circle at the perigee
+  // radius and angular rate, bounds the midpoint error of an interval h
+  // long by h^4 / 384 times it.
+  const double e = constants_.eo;
+  const double rate = constants_.xnodp * (1.0 + e) * (1.0 + e) /
+                      std::pow(1.0 - e * e, 1.5);
+  const double snap =
+      constants_.aodp * kXKMPER * (1.0 - e) * std::pow(rate, 4.0);
+  const double spacing = std::clamp(std::pow(384.0 * tolerance / snap, 0.25),
+                                    kMinKnotMinutes, kMaxKnotMinutes);
+  const size_t intervals = static_cast<size_t>(std::ceil(span / spacing));
+  // Each interval costs four propagations, its knot and three probes.
+  if (!(tolerance > 0.0) || !(span > 0.0) || count < 8 * (intervals + 1) ||
+      !std::is_sorted(tsince, tsince + count)) {
+    Propagate(tsince, count, states);
+    return;
+  }
+  const auto evaluate = [this](std::vector<Knot>* knots) {
+    std::vector<double> t(knots->size());
+    for (size_t i = 0; i < t.size(); ++i) t[i] = (*knots)[i].t;
+    States at;
+    Propagate(t.data(), t.size(), &at);
+    for (size_t i = 0; i < t.size(); ++i) {
+      Knot& knot = (*knots)[i];
+      knot.p[0] = at.x[i];
+      knot.p[1] = at.y[i];
+      knot.p[2] = at.z[i];
+      knot.v[0] = at.vx[i] * 60.0;
+      knot.v[1] = at.vy[i] * 60.0;
+      knot.v[2] = at.vz[i] * 60.0;
+    }
+  };
+  std::vector<Knot> knots(intervals + 1);
+  for (size_t i = 0; i < intervals; ++i) {
+    knots[i].t = tsince[0] + span * i / intervals;
+  }
+  knots[intervals].t = tsince[count - 1];
+  evaluate(&knots);
+
+  // Interval i runs from knots[i] to knots[i + 1].
+  enum Check : char { kUnchecked, kGood, kDirect };
+  std::vector<Check> checks(intervals, kUnchecked);
+  // The interpolant errs most at the midpoint through the curvature of the
+  // orbit, and near the quarter points through the velocities, which SGP4
+  // does not compute as the exact derivative of its positions: up to
+  // 1 m/s apart for eccentric deep-space orbits. Every interval is checked
+  // at all three.
+  constexpr double kProbes[] = {0.25, 0.5, 0.75};
+  constexpr size_t kProbeCount = sizeof(kProbes) / sizeof(kProbes[0]);
+  for (;;) {
+    std::vector<Knot> probes;
+    for (size_t i = 0; i < checks.size(); ++i) {
+      if (checks[i] != kUnchecked) continue;
+      const double h = knots[i + 1].t - knots[i].t;
+      for (double s : kProbes) probes.push_back({knots[i].t + s * h, {}, {}});
+    }
+    if (probes.empty()) break;
+    evaluate(&probes);
+    std::vector<Knot> refined;
+    std::vector<Check> refined_checks;
+    size_t m = 0;
+    for (size_t i = 0; i < checks.size(); ++i) {
+      refined.push_back(knots[i]);
+      if (checks[i] != kUnchecked) {
+        refined_checks.push_back(checks[i]);
+        continue;
+      }
+      double error = 0.0;
+      for (size_t k = 0; k < kProbeCount; ++k) {
+        const Knot& probe = probes[m + k];
+        double p[3], v[3];
+        Hermite(knots[i], knots[i + 1], probe.t, p, v);
+        const double dx = p[0] - probe.p[0];
+        const double dy = p[1] - probe.p[1];
+        const double dz = p[2] - probe.p[2];
+        error = std::max(error, std::sqrt(dx * dx + dy * dy + dz * dz));
+      }
+      const Knot& middle = probes[m + kProbeCount / 2];
+      m += kProbeCount;
+      if (error <= tolerance) {
+        refined_checks.push_back(kGood);
+      } else if (middle.t - knots[i].t < kMinKnotMinutes) {
+        refined_checks.push_back(kDirect);
+      } else {
+        // The midpoint, already propagated, becomes a knot.
+        refined.push_back(middle);
+        refined_checks.push_back(kUnchecked);
+        refined_checks.push_back(kUnchecked);
+      }
+    }
+    refined.push_back(knots.back());
+    knots.swap(refined);
+    checks.swap(refined_checks);
+  }
+
+  states->Resize(count);
+  std::vector<size_t> direct;
+  size_t i = 0;
+  for (size_t j = 0; j < count; ++j) {
+    while (i + 1 < checks.size() && knots[i + 1].t < tsince[j]) ++i;
+    if (checks[i] == kDirect) {
+      direct.push_back(j);
+      continue;
+    }
+    double p[3], v[3];
+    Hermite(knots[i], knots[i + 1], tsince[j], p, v);
+    states->x[j] = p[0];
+    states->y[j] = p[1];
+    states->z[j] = p[2];
+    states->vx[j] = v[0] / 60.0;
+    states->vy[j] = v[1] / 60.0;
+    states->vz[j] = v[2] / 60.0;
+  }
+  if (direct.empty()) return;
+  std::vector<double> t(direct.size());
+  for (size_t k = 0; k < direct.size(); ++k) t[k] = tsince[direct[k]];
+  States at;
+  Propagate(t.data(), t.size(), &at);
+  for (size_t k = 0; k < direct.size(); ++k) {
+    const size_t j = direct[k];
+    states->x[j] = at.x[k];
+    states->y[j] = at.y[k];
+    states->z[j] = at.z[k];
+    states->vx[j] = at.vx[k];
+    states->vy[j] = at.vy[k];
+    states->vz[j] = at.vz[k];
+  }
+}
+
+SGP4Constellation::SGP4Constellation(size_t count)
+    : stride_(count),
+      terms_(term::kCount * stride_),
+      satellites_(count),
+      epochs_(count) {}
+
+void SGP4Constellation::Set(size_t i, const Tle& tle) {
+  satellites_[i].reset();
+  const SGP4Batch satellite(tle);
+  Scatter(satellite.constants(), terms_.data() + i, stride_);
+  epochs_[i] = satellite.Epoch().Ticks();
+  satellites_[i] = std::make_unique<const SGP4>(satellite.sgp4());
+}
+
+void SGP4Constellation::Propagate(const DateTime& date, size_t begin,
+                                  size_t end, SGP4Batch::States* states,
+                                  std::vector<std::string>* errors) const {
+  static const Kernel kernel = SelectKernel();
+  const size_t width = kernel.run != nullptr ? kernel.width : 1;
+  double tsince[kMaxWidth], lanes_out[6][kMaxWidth];
+  double tail_terms[term::kCount * kMaxWidth];
+  double* out[6];
+  for (int k = 0; k < 6; ++k) out[k] = lanes_out[k];
+  for (size_t i = begin; i < end; i += width) {
+    const size_t rest = std::min(width, end - i);
+    for (size_t j = 0; j < width; ++j) {
+      tsince[j] = SGP4Batch::MinutesBetween(
+          epochs_[i + std::min(j, rest - 1)], date.Ticks());
+    }
+    unsigned redo = ~0u;
+    if (kernel.run != nullptr && rest == width) {
+      redo = kernel.run(terms_.data() + i, stride_, tsince, out);
+    } else if (kernel.run != nullptr) {
+      // Pad the tail with copies of its last satellite, rather than read
+      // satellites past `end` that another call may be setting.
+      for (size_t t = 0; t < term::kCount; ++t) {
+        for (size_t j = 0; j < width; ++j) {
+          tail_terms[t * kMaxWidth + j] =
+              terms_[t * stride_ + i + std::min(j, rest - 1)];
+        }
+      }
+      redo = kernel.run(tail_terms, kMaxWidth, tsince, out);
+    }
+    for (size_t j = 0; j < rest; ++j) {
+      const size_t s = i + j;
+      if (satellites_[s] != nullptr && !(redo & (1u << j))) {
+        states->x[s] = lanes_out[0][j];
+        states->y[s] = lanes_out[1][j];
+        states->z[s] = lanes_out[2][j];
+        states->vx[s] = lanes_out[3][j];
+        states->vy[s] = lanes_out[4][j];
+        states->vz[s] = lanes_out[5][j];
+        continue;
+      }
+      states->x[s] = states->y[s] = states->z[s] = 0.0;
+      states->vx[s] = states->vy[s] = states->vz[s] = 0.0;
+      if (satellites_[s] == nullptr) continue;
+      try {
+        Store(satellites_[s]->FindPosition(tsince[j]), s, states);
+      } catch (const std::exception& e) {
+        (*errors)[s] = e.what();
+      }
+    }
+  }
+}
@@ -0,0 +1,202 @@
+/**
+ * @file sgp4_batch.h
+ * @brief SGP4 propagation of one satellite to many instants at once
+ *
+ * Near-space orbits (period under 225 minutes) are propagated a vector of
+ * instants at a time: the arithmetic of SGP4::FindPositionSGP4 and
+ * CalculateFinalPositionVelocity, with every variable that depends on the
+ * time widened to one lane per instant. Deep-space orbits, and instants a
+ * lane cannot settle on its own (a decayed orbit, say), go through
+ * SGP4::FindPosition one at a time, which also raises what SGP4 raises.
+ *
+ * For resonant deep-space orbits FindPosition integrates the resonance terms
+ * in 720-minute steps, keeping the integrator in mutable state that it only
+ * carries forward while the instants move away from the epoch; any other
+ * instant restarts it at the epoch. SGP4Batch keeps copies of the
+ * propagator with the integrator run to checkpoints kCheckpointMinutes
+ * apart, thinned out as they get many, and each call resumes from the one
+ * nearest its first instant instead. The steps taken are the ones
+ * FindPosition takes from the epoch, so the states are the same to the bit.
+ *
+ * SGP4Constellation runs the same lanes across satellites instead: many
+ * TLEs propagated to one instant, with the constants of every satellite
+ * kept term by term so that a vector of satellites loads each term at once.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sgp4/include/DateTime.h"
+#include "sgp4/include/OrbitalElements.h"
+#include "sgp4/include/SGP4.h"
+#include "sgp4/include/TimeSpan.h"
+#include "sgp4/include/Tle.h"
+
+class SGP4Batch {
+ public:
+  // The near-space terms SGP4::Initialise derives from the elements, named
+  // as in SGP4.h. Times are in minutes, angles in radians and distances in
+  // earth radii.
+  struct Constants {
+    double xmo;
+    double xnodeo;
+    double omegao;
+    double eo;
+    double xincl;
+    double bstar;
+    double aodp;
+    double xnodp;
+    double cosio;
+    double sinio;
+    double eta;
+    double t2cof;
+    double x1mth2;
+    double x3thm1;
+    double x7thm1;
+    double aycof;
+    double xlcof;
+    double xnodcf;
+    double c1;
+    double c4;
+    double omgdot;
+    double xnodot;
+    double xmdot;
+    double c5;
+    double omgcof;
+    double xmcof;
+    double delmo;
+    double sinmo;
+    double d2;
+    double d3;
+    double d4;
+    double t3cof;
+    double t4cof;
+    double t5cof;
+    bool simple;  // perigee under 220 km: the drag terms stop at t^2
+    bool deep;    // period of 225 minutes or more, left to SGP4 (SDP4)
+  };
+
+  // ECI states, one array per component: positions in km, velocities in
+  // km/s.
+  struct States {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::vector<double> vx;
+    std::vector<double> vy;
+    std::vector<double> vz;
+
+    void Resize(size_t count);
+    size_t size() const { return x.size(); }
+  };
+
+  // Throws what SGP4's constructor throws for unusable elements.
+  explicit SGP4Batch(const Tle& tle);
+
+  // Resonance checkpoints of deep-space orbits lie a multiple of this
+  // apart: 20 integrator steps, about 1.5 us to catch up on. Past
+  // kMaxCheckpoints of 720 bytes every other one is dropped, doubling the
+  // spacing and the catching up.
+  static constexpr double kCheckpointMinutes = 14400.0;
+  static constexpr size_t kMaxCheckpoints = 64;
+
+  // Bounds on the knot spacing of PropagateDense.
+  static constexpr double kMinKnotMinutes = 1.0 / 60.0;
+  static constexpr double kMaxKnotMinutes = 10.0;
+
+  // FindPosition on this mutates a deep-space integrator, so it is not for
+  // concurrent use; Propagate is.
+  const SGP4& sgp4() const { return sgp4_; }
+  DateTime Epoch() const { return elements_.Epoch(); }
+  bool near_space() const { return !constants_.deep; }
+  const Constants& constants() const { return constants_; }
+
+  // Propagates to `count` instants given in minutes since the epoch and
+  // resizes `states` to hold them. Entry i of every array agrees with
+  // sgp4().FindPosition(tsince[i]) to within rounding, and an instant that
+  // makes FindPosition throw throws the same here. Calls may run
+  // concurrently.
+  void Propagate(const double* tsince, size_t count, States* states) const;
+
+  // Propagate for instants sampled far more densely than the orbit bends,
+  // in increasing order: states are propagated only at knots, and positions
+  // in between follow the cubic Hermite interpolant of the knot positions
+  // and velocities, velocities its derivative. Knots start as far apart as
+  // the orbit's perigee allows for `tolerance` km, and an interval whose
+  // interpolant strays further than that from the propagated position at
+  // its midpoint or quarter points is split at the midpoint; the error
+  // elsewhere stays within a few percent of `tolerance`. Instants too
+  // sparse to gain from it, out of order, or in an interval still failing
+  // at kMinKnotMinutes are propagated directly. Throws as Propagate does.
+  void PropagateDense(const double* tsince, size_t count, double tolerance,
+                      States* states) const;
+
+  // Minutes from the epoch to `date`, as SGP4::FindPosition(date) takes it.
+  // The vendored TimeSpan::TotalMinutes echoes to stdout, so the division
+  // is spelt out here.
+  double MinutesSinceEpoch(const DateTime& date) const {
+    return MinutesBetween(elements_.Epoch().Ticks(), date.Ticks());
+  }
+
+  static double MinutesBetween(int64_t from, int64_t to) {
+    return static_cast<double>(to - from) / TicksPerMinute;
+  }
+
+  // Resonance checkpoints held, at most kMaxCheckpoints.
+  size_t checkpoint_count() const;
+
+ private:
+  static Constants Derive(const OrbitalElements& elements);
+
+  // A copy of sgp4_ with its integrator at the last checkpoint interval
+  // boundary between the epoch and `tsince`. The integration runs outside
+  // checkpoints_mutex_ and records the checkpoints it passes afterwards.
+  SGP4 Resume(double tsince) const;
+
+  SGP4 sgp4_;
+  OrbitalElements elements_;
+  Constants constants_;
+  std::vector<double> terms_;  // constants_ repeated across a vector
+
+  mutable std::mutex checkpoints_mutex_;
+  // Guarded by checkpoints_mutex_. Deep space only: the propagator at
+  // i * kCheckpointMinutes from the epoch, by i, for every multiple i of
+  // checkpoint_stride_ from 0 out to the furthest checkpoint on either
+  // side.
+  mutable std::map<int64_t, SGP4> checkpoints_;
+  mutable int64_t checkpoint_stride_ = 1;
+};
+
+class SGP4Constellation {
+ public:
+  // `count` satellites, none of them set yet.
+  explicit SGP4Constellation(size_t count);
+
+  size_t size() const { return satellites_.size(); }
+
+  // Makes satellite i the one `tle` describes. Throws what SGP4Batch throws
+  // and leaves the satellite unset. Calls for distinct satellites may run
+  // concurrently.
+  void Set(size_t i, const Tle& tle);
+
+  // Propagates satellites [begin, end) to `date` into the same entries of
+  // `states` and `errors`, which hold size() entries. An unset satellite
+  // is left at zeros, and so is one SGP4 throws for, which also gets the
+  // reason in its error. Calls for disjoint ranges may run concurrently,
+  // and alongside Set for satellites outside the range.
+  void Propagate(const DateTime& date, size_t begin, size_t end,
+                 SGP4Batch::States* states,
+                 std::vector<std::string>* errors) const;
+
+ private:
+  size_t stride_;              // entries per term, size()
+  std::vector<double> terms_;  // term t of satellite i at t * stride_ + i
+  std::vector<std::unique_ptr<const SGP4>> satellites_;
+  std::vector<int64_t> epochs_;  // ticks
+};
@@ -0,0 +1,164 @@
+/**
+ * @file sgp4_batch_test.cpp
+ * @brief In-process tests of SGP4Batch against SGP4::FindPosition
+ */
+#include "sgp4_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "sgp4/include/Eci.h"
+
+#define CATCH_CONFIG_MAIN
+#include "../testing/catch.hpp"
+
+namespace {
+
+Tle IssTle() {
+  return Tle("ISS",
+             "1 25544U 98067A   20173.69712963  "
+             ".00000371  00000-0  14697-4 0  9998",
+             "2 25544  51.6445 326.1422 0002733  "
+             "71.2042 114.5589 15.49451886232717");
+}
+
+// Resonant: a period of a sidereal day.
+Tle GeoTle() {
+  return Tle("GEO",
+             "1 28884U 05041A   20173.50000000 "
+             "-.00000100  00000-0  00000+0 0  9990",
+             "2 28884   0.0500 270.0000 0002000 "
+             "100.0000 200.0000  1.00270000 50000");
+}
+
+// A day of instants, not a multiple of any vector width and starting before
+// the epoch.
+std::vector<double> Day() {
+  std::vector<double> tsince;
+  for (int i = 0; i < 1443; ++i) tsince.push_back(-60.0 + i * 1.01);
+  return tsince;
+}
+
+// The largest position (km) and velocity (km/s) differences between
+// Propagate and FindPosition over `tsince`.
+std::pair<double, double> MaxErrors(const SGP4Batch& satellite,
+                                    const std::vector<double>& tsince) {
+  SGP4Batch::States states;
+  satellite.Propagate(tsince.data(), tsince.size(), &states);
+  REQUIRE(states.size() == tsince.size());
+  double position = 0, velocity = 0;
+  for (size_t i = 0; i < tsince.size(); ++i) {
+    const Eci eci = satellite.sgp4().FindPosition(tsince[i]);
+    const Vector& r = eci.Position();
+    const Vector& v = eci.Velocity();
+    position = std::max(position, std::sqrt(
+        std::pow(r.x - states.x[i], 2) + std::pow(r.y - states.y[i], 2) +
+        std::pow(r.z - states.z[i], 2)));
+    velocity = std::max(velocity, std::sqrt(
+        std::pow(v.x - states.vx[i], 2) + std::pow(v.y - states.vy[i], 2) +
+        std::pow(v.z - states.vz[i], 2)));
+  }
+  return {position, velocity};
+}
+
+}  // namespace
+
+TEST_CASE("Near-space states are within a millimetre of SGP4's",
+          "[sgp4_batch]") {
+  const SGP4Batch iss(IssTle());
+  REQUIRE(iss.near_space());
+  const auto errors = MaxErrors(iss, Day());
+  REQUIRE(errors.first < 1e-6);
+  REQUIRE(errors.second < 1e-9);
+}
+
+TEST_CASE("Deep-space states are SGP4's own", "[sgp4_batch]") {
+  const SGP4Batch geo(GeoTle());
+  REQUIRE_FALSE(geo.near_space());
+  const auto errors = MaxErrors(geo, Day());
+  REQUIRE(errors.first == 0);
+  REQUIRE(errors.second == 0);
+}
+
+TEST_CASE("An instant past the decay throws as SGP4 does", "[sgp4_batch]") {
+  const SGP4Batch decaying(Tle("LOW",
+      "1 25544U 98067A   20173.69712963  "
+      ".00020371  00000-0  34697-1 0  9998",
+      "2 25544  51.6445 326.1422 0012733  "
+      "71.2042 114.5589 16.29451886232717"));
+  const std::vector<double> late = {0.0, 10.0, 1e4, 20.0, 30.0};
+  SGP4Batch::States states;
+  REQUIRE_THROWS_AS(decaying.sgp4().FindPosition(1e4), std::exception);
+  REQUIRE_THROWS_AS(decaying.Propagate(late.data(), late.size(), &states),
+                    std::exception);
+}
+
+TEST_CASE("Deep-space states years out resume from checkpoints",
+          "[sgp4_batch]") {
+  const SGP4Batch geo(GeoTle());
+  // Back and forth, so that each run of instants resumes the resonance
+  // integrator from a checkpoint rather than from the epoch.
+  std::vector<double> late;
+  for (int i = 0; i < 300; ++i) {
+    late.push_back((i % 2 ? -1 : 1) * (1e6 - 5e3 * (i % 7)) + i);
+  }
+  SGP4Batch::States states;
+  geo.Propagate(late.data(), late.size(), &states);
+  geo.Propagate(late.data(), late.size(), &states);
+  for (size_t i = 0; i < late.size(); ++i) {
+    SGP4 fresh(GeoTle());
+    const Eci eci = fresh.FindPosition(late[i]);
+    REQUIRE(eci.Position().x == states.x[i]);
+    REQUIRE(eci.Position().y == states.y[i]);
+    REQUIRE(eci.Position().z == states.z[i]);
+    REQUIRE(eci.Velocity().x == states.vx[i]);
+  }
+
+  SECTION("Concurrent calls publish checkpoints within the bound") {
+    auto further = [&](size_t t) {
+      std::vector<double> tsince(late);
+      for (double& minutes : tsince) minutes *= 1.0 + t;
+      return tsince;
+    };
+    std::vector<SGP4Batch::States> racing(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < racing.size(); ++t) {
+      threads.emplace_back([&, t] {
+        const std::vector<double> tsince = further(t);
+        geo.Propagate(tsince.data(), tsince.size(), &racing[t]);
+      });
+    }
+    for (std::thread& thread : threads) thread.join();
+    REQUIRE(geo.checkpoint_count() <= SGP4Batch::kMaxCheckpoints);
+    REQUIRE(racing[0].x == states.x);
+    for (size_t t = 1; t < racing.size(); ++t) {
+      const std::vector<double> tsince = further(t);
+      SGP4Batch::States again;
+      geo.Propagate(tsince.data(), tsince.size(), &again);
+      REQUIRE(racing[t].x == again.x);
+      REQUIRE(racing[t].vz == again.vz);
+    }
+  }
+}
+
+TEST_CASE("Dense output stays within its tolerance", "[sgp4_batch]") {
+  const SGP4Batch iss(IssTle());
+  // 10 Hz for three hours.
+  std::vector<double> dense;
+  for (int i = 0; i < 108000; ++i) dense.push_back(i / 600.0);
+  SGP4Batch::States direct, interpolated;
+  iss.Propagate(dense.data(), dense.size(), &direct);
+  iss.PropagateDense(dense.data(), dense.size(), 1e-3, &interpolated);
+  double worst = 0;
+  for (size_t i = 0; i < dense.size(); ++i) {
+    worst = std::max(worst, std::sqrt(
+        std::pow(direct.x[i] - interpolated.x[i], 2) +
+        std::pow(direct.y[i] - interpolated.y[i], 2) +
+        std::pow(direct.z[i] - interpolated.z[i], 2)));
+  }
+  REQUIRE(worst < 1.05e-3);
+}
@@ -0,0 +1,122 @@
+/**
+ * @file sharded_lru.h
+ * @brief Bounded LRU map split into independently locked shards
+ *
+ * The storage behind igrf_server's caches. A key's hash picks its shard,
+ * and each shard keeps its own LRU order and its share of the capacity, so
+ * calls on different shards never wait on one another.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Mixes `value` into the hash `seed`, as boost::hash_combine.
+inline size_t HashCombine(size_t seed, size_t value) {
+  return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+template <typename Key, typename Value, typename Hash>
+class ShardedLru {
+  using Order = std::list<std::pair<Key, Value>>;
+
+ public:
+  // What an entry costs: its list node, its hash node and a bucket.
+  static constexpr size_t kEntryBytes =
+      sizeof(typename Order::value_type) + 2 * sizeof(void*) + sizeof(Key) +
+      sizeof(typename Order::iterator) + 3 * sizeof(void*);
+
+  // Holds at most `capacity` entries, which may be 0, over `shards`
+  // shards. The first capacity % shards shards take one entry more than the
+  // others, so that their capacities add up to `capacity`.
+  ShardedLru(size_t capacity, size_t shards) : capacity_(capacity) {
+    shards_.resize(std::max<size_t>(shards, 1));
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      shards_[i].reset(new Shard);
+      shards_[i]->capacity = capacity / shards_.size() +
+                             (i < capacity % shards_.size() ? 1 : 0);
+    }
+  }
+
+  ShardedLru(const ShardedLru&) = delete;
+  ShardedLru& operator=(const ShardedLru&) = delete;
+
+  // Copies the entry for `key` into `value` and marks it most recently used.
+  bool Lookup(const Key& key, Value* value) {
+    Shard& shard = ShardOf(Hash()(key));
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto it = shard.entries.find(key);
+      if (it != shard.entries.end()) {
+        shard.order.splice(shard.order.begin(), shard.order, it->second);
+        *value = it->second->second;
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  void Insert(const Key& key, const Value& value) {
+    Shard& shard = ShardOf(Hash()(key));
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+      it->second->second = value;
+      shard.order.splice(shard.order.begin(), shard.order, it->second);
+      return;
+    }
+    if (shard.capacity == 0) return;
+    if (shard.entries.size() >= shard.capacity) {
+      shard.entries.erase(shard.order.back().first);
+      shard.order.pop_back();
+      evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.order.emplace_front(key, value);
+    shard.entries.emplace(key, shard.order.begin());
+  }
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      total += shard->entries.size();
+    }
+    return total;
+  }
+  uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+  uint64_t evictions() const {
+    return evictions_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Shard {
+    std::mutex mutex;
+    size_t capacity;
+    // Most recently used first.
+    Order order;
+    std::unordered_map<Key, typename Order::iterator, Hash> entries;
+  };
+
+  Shard& ShardOf(size_t hash) {
+    // The low bits pick the bucket inside the shard, so use the high ones.
+    return *shards_[(hash >> (sizeof(size_t) * 4)) % shards_.size()];
+  }
+
+  const size_t capacity_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> evictions_{0};
+};
@@ -0,0 +1,68 @@
+/**
+ * @file sharded_lru_test.cpp
+ * @brief In-process tests of ShardedLru
+ */
+#include "sharded_lru.h"
+
+#include <cstdint>
+
+#define CATCH_CONFIG_MAIN
+#include "../testing/catch.hpp"
+
+namespace {
+
+// splitmix64's finalizer: spreads consecutive keys over the high bits that
+// pick a shard.
+struct MixHash {
+  size_t operator()(uint64_t key) const {
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+  }
+};
+
+using Lru = ShardedLru<uint64_t, int, MixHash>;
+
+// Inserts far more keys than fit and returns how many are kept.
+size_t Fill(Lru* lru) {
+  for (uint64_t key = 0; key < 10000; ++key) lru->Insert(key, 1);
+  return lru->size();
+}
+
+}  // namespace
+
+TEST_CASE("A ShardedLru holds exactly its capacity", "[sharded_lru]") {
+  SECTION("More entries than shards, not a multiple of them") {
+    Lru lru(100, 16);
+    REQUIRE(lru.capacity() == 100);
+    REQUIRE(Fill(&lru) == 100);
+    REQUIRE(lru.evictions() == 10000 - 100);
+  }
+  SECTION("Fewer entries than shards") {
+    Lru lru(3, 16);
+    REQUIRE(Fill(&lru) == 3);
+  }
+  SECTION("No entries at all") {
+    Lru lru(0, 16);
+    REQUIRE(Fill(&lru) == 0);
+    int value = 0;
+    REQUIRE_FALSE(lru.Lookup(7, &value));
+    REQUIRE(lru.evictions() == 0);
+  }
+}
+
+TEST_CASE("A ShardedLru evicts the least recently used entry",
+          "[sharded_lru]") {
+  Lru lru(2, 1);
+  lru.Insert(1, 10);
+  lru.Insert(2, 20);
+  int value = 0;
+  REQUIRE(lru.Lookup(1, &value));
+  lru.Insert(3, 30);
+  REQUIRE(lru.Lookup(1, &value));
+  REQUIRE(value == 10);
+  REQUIRE_FALSE(lru.Lookup(2, &value));
+  REQUIRE(lru.Lookup(3, &value));
+  REQUIRE(lru.hits() == 3);
+  REQUIRE(lru.misses() == 1);
+}
@@ -0,0 +1,101 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+ThreadPool::ThreadPool(size_t threads) {
+  workers_.reserve(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back([this] { Work(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  for (auto& worker : workers_) worker.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  ready_.notify_one();
+}
+
+namespace {
+
+// The chunks of one ParallelFor. Helpers hold it by shared_ptr, so that one
+// dequeued only after the call returned still finds it, sees no chunk left
+// and touches nothing else.
+struct Loop {
+  const std::function<void(size_t, size_t)>* body;
+  size_t count;
+  size_t grain;
+  size_t chunks;
+  std::atomic<size_t> next{0};
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t finished = 0;  // chunks run to the end, guarded by mutex
+
+  void Run() {
+    size_t ran = 0;
+    for (size_t chunk = next++; chunk < chunks; chunk = next++) {
+      const size_t begin = chunk * grain;
+      (*body)(begin, std::min(begin + grain, count));
+      ++ran;
+    }
+    if (ran == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    finished += ran;
+    if (finished == chunks) done.notify_all();
+  }
+};
+
+}  // namespace
+
+void ThreadPool::ParallelFor(size_t count, size_t grain,
+                             const std::function<void(size_t, size_t)>& body) {
+  if (count == 0) return;
+  grain = std::max<size_t>(grain, 1);
+  const size_t chunks = (count + grain - 1) / grain;
+  const size_t helpers = std::min(workers_.size(), chunks - 1);
+  if (helpers == 0) {
+    body(0, count);
+    return;
+  }
+
+  auto loop = std::make_shared<Loop>();
+  loop->body = &body;
+  loop->count = count;
+  loop->grain = grain;
+  loop->chunks = chunks;
+  for (size_t i = 0; i < helpers; ++i) {
+    Submit([loop] { loop->Run(); });
+  }
+  loop->Run();
+  // Only chunks a helper has claimed are left to wait for; helpers still
+  // queued behind other work will find none.
+  std::unique_lock<std::mutex> lock(loop->mutex);
+  loop->done.wait(lock, [&] { return loop->finished == chunks; });
+}
+
+void ThreadPool::Work() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
@@ -0,0 +1,43 @@
+/**
+ * @file thread_pool.h
+ * @brief Fixed-size worker pool shared by the igrf_server handlers
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const { return workers_.size(); }
+
+  void Submit(std::function<void()> task);
+
+  // Runs body(begin, end) over [0, count) in chunks of at most `grain`
+  // items. The calling thread takes chunks as well, and the call returns
+  // once every chunk has finished; it never waits for a helper that has
+  // not started on a chunk, so helpers queued behind other work leave the
+  // caller to run the chunks itself.
+  void ParallelFor(size_t count, size_t grain,
+                   const std::function<void(size_t, size_t)>& body);
+
+ private:
+  void Work();
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+};
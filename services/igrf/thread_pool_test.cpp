@@ -0,0 +1,48 @@
+/**
+ * @file thread_pool_test.cpp
+ * @brief In-process tests of ThreadPool
+ */
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../testing/catch.hpp"
+
+TEST_CASE("ParallelFor runs every item once", "[thread_pool]") {
+  for (size_t threads : {0, 1, 4}) {
+    ThreadPool pool(threads);
+    std::vector<std::atomic<int>> seen(100003);
+    pool.ParallelFor(seen.size(), 4096, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) ++seen[i];
+    });
+    for (const std::atomic<int>& count : seen) REQUIRE(count == 1);
+  }
+}
+
+TEST_CASE("ParallelFor does not wait for helpers stuck behind other work",
+          "[thread_pool]") {
+  ThreadPool pool(2);
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  for (size_t i = 0; i < pool.size(); ++i) {
+    pool.Submit([released] { released.wait(); });
+  }
+  std::atomic<size_t> items{0};
+  auto parallel = std::async(std::launch::async, [&] {
+    pool.ParallelFor(1000, 10, [&](size_t begin, size_t end) {
+      items += end - begin;
+    });
+  });
+  const bool returned = parallel.wait_for(std::chrono::seconds(10)) ==
+                        std::future_status::ready;
+  // The helpers it queued run once the workers are free, after the call
+  // has returned, and must find nothing left to do.
+  release.set_value();
+  parallel.wait();
+  REQUIRE(returned);
+  REQUIRE(items == 1000);
+}